@@ -27,6 +27,26 @@
 
   M401   - Set probe connected.
   M402   - Clear probe Connected.
+  M403   - Two stage probe: seek along I/J/K at P feed, back off R (default 2mm) and probe L times (default 1) at Q feed (default P/10).
+           Reports the mean trigger position. Example: M403 K-20 P300 Q30 R1 L3
+  M404   - Invalidate the cached tool length of tool P, all tools if P is omitted.
+  M405   - Surface map: probe a grid of P x Q points spaced I/J apart starting at the current XY position, seeking down
+           at most K from the current Z at the modal feed rate. The current Z is the clearance height between points.
+           Heights relative to the first point are streamed as [MAP:x index,y index,height]. Example: M405 I10 J10 P20 Q15 K5 F100
+  M406   - Repeatability test: seek along I/J/K at P feed, then back off R (default 2mm) and probe L times at P feed.
+           Reports trigger position statistics per axis: [RPT:n|MEAN:..|SD:..|MIN:..|MAX:..|RANGE:..]. Example: M406 K-10 P200 R1 L25
+  M407   - Select probe source P: 0 - main probe, 1 - toolsetter, 2 - second toolsetter, 3 - wireless probe.
+           Without P the source is selected from the current tool number again.
+  M408   - Probing cycle P at F feed, each touch is a two stage probe with R back off (default 2mm). Optionally Q1 - Q6 writes
+           the result to G54 - G59 so it becomes the origin. Reports the result in work coordinates.
+           P0 - bore center: start inside the bore, probe up to I along X and J (default I) along Y. Example: M408 P0 I15 F200 Q1
+           P1 - boss center: start above the center, probe from I outside the center along X and J (default I) along Y, K below the start.
+           P2 - edge: probe along the I/J/K vector.
+           P3 - outside corner: start outside the corner at probing depth, probe I along X at J along Y and J along Y at I along X.
+           P4 - inside corner: start inside the corner, probe I along X and J along Y.
+  M409   - Scan: move along the I/J/K vector at F feed with protection suspended, recording the position on every probe make and break
+           and, while the probe is deflected, every P mm along the move and/or every Q milliseconds.
+           Samples are streamed in batches as [SCAN:x,y,z,flags;...], flags: 1 - deflected, 2 - make/break. Example: M409 I100 P0.5 F300
 
   NOTES: The symbol TOOLSETTER_RADIUS (defined in grbl/config.h, default 5.0mm) is the tolerance for checking "@ G59.3".
          When $341 tool change mode 1 or 2 is active it is possible to jog to/from the G59.3 position.
@@ -39,15 +59,108 @@
 #include <math.h>
 #include <string.h>
 #include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
 
 #include "probe_plugin.h"
 
-#define RELAY_DEBOUNCE 50 // ms - increase if relay is slow and/or bouncy
-#define PROBE_DEBOUNCE 25 // ms - increase if probe is slow and/or bouncy
+#ifndef PROBE_PLUGIN_METRICS
+#define PROBE_PLUGIN_METRICS 0 // set to 1 to collect per hook latency statistics, reported by $PROBESTATS
+#endif
+
+#if PROBE_PLUGIN_METRICS
+#ifndef PROBE_METRICS_TIMESTAMP // may be redefined to a cycle counter read for better resolution
+#define PROBE_METRICS_TIMESTAMP() (hal.get_micros ? hal.get_micros() : 0)
+#define PROBE_METRICS_UNIT "us"
+#endif
+#define PROBE_METRICS_BUCKETS 8 // histogram buckets: <1, <2, <4 ... <64 and >= 64 timestamp units
+#endif
+
+#ifndef PROBE_TRACE_SIZE
+#define PROBE_TRACE_SIZE 64 // number of events kept in the trace, must be a power of 2
+#endif
+
+#ifndef PROBE_STORM_EDGES
+#define PROBE_STORM_EDGES 16 // edges within one debounce window reported as an interrupt storm
+#endif
+
+#ifndef PROBE_MACRO_LENGTH
+#define PROBE_MACRO_LENGTH 95 // max length of the connect/disconnect macro settings
+#endif
+#define PROBE_MACRO_LINES 8   // max number of lines per macro, separated by |
+
+#ifndef PROBE_SCAN_SIZE
+#define PROBE_SCAN_SIZE 128 // scan sample ring buffer size, must be a power of 2
+#endif
+#define PROBE_SCAN_BATCH 8  // samples per [SCAN:] line
+#define SCAN_DEFLECTED bit(0)
+#define SCAN_EDGE bit(1)
+
+#ifndef PROBE_MAP_SIZE
+#define PROBE_MAP_SIZE 512 // max number of surface map points, 2 bytes each
+#endif
+#define PROBE_MAP_NONE INT16_MIN // map point not probed
+
+#define PROBE_RECORD_PAYLOAD (4 + N_AXIS * 4)
+#define PROBE_RECORD_SUCCEEDED  bit(0)
+#define PROBE_RECORD_TOOLSETTER bit(1)
+#define PROBE_RECORD_CYCLE      bit(2)
+#define PROBE_RECORD_SOURCE_SHIFT 4 // bits 4-5: probe source
+
+#define RELAY_DEBOUNCE 50 // ms - default, increase if relay is slow and/or bouncy
+#define PROBE_DEBOUNCE 25 // ms - default, increase if probe is slow and/or bouncy
 
 #define PROBE_PLUGIN_PORT_SETTING1 Setting_UserDefined_7
 #define PROBE_PLUGIN_PORT_SETTING2 Setting_UserDefined_8
 #define PROBE_PLUGIN_FIXTURE_INVERT_LIMIT_SETTING Setting_UserDefined_9
+#define PROBE_PLUGIN_BASE_SETTINGS 3 // the settings above, always registered
+
+// All other settings use a block of consecutive ids of their own ($900 - $924 by default) and leave the user defined
+// range to the user. Rebuild with another base if the block collides with settings of other plugins, init checks it.
+#ifndef PROBE_PLUGIN_SETTINGS_BASE
+#define PROBE_PLUGIN_SETTINGS_BASE 900
+#endif
+#define PROBE_PLUGIN_SETTING(n) ((setting_id_t)(PROBE_PLUGIN_SETTINGS_BASE + (n)))
+
+#define PROBE_PLUGIN_PROTECT_PORT_SETTING PROBE_PLUGIN_SETTING(0)
+#define PROBE_PLUGIN_PROBE_DEBOUNCE_SETTING PROBE_PLUGIN_SETTING(1)
+#define PROBE_PLUGIN_CONNECT_DEBOUNCE_SETTING PROBE_PLUGIN_SETTING(2)
+#define PROBE_PLUGIN_REPORT_INTERVAL_SETTING PROBE_PLUGIN_SETTING(3)
+#define PROBE_PLUGIN_OPTIONS_SETTING PROBE_PLUGIN_SETTING(4)
+#define PROBE_PLUGIN_CACHE_AGE_SETTING PROBE_PLUGIN_SETTING(5)
+#define PROBE_PLUGIN_CACHE_SPINDLE_SETTING PROBE_PLUGIN_SETTING(6)
+#define PROBE_PLUGIN_ZONE_RADIUS_SETTING PROBE_PLUGIN_SETTING(7)
+#define PROBE_PLUGIN_ZONE_HEIGHT_SETTING PROBE_PLUGIN_SETTING(8)
+#define PROBE_PLUGIN_OVERTRAVEL_SETTING PROBE_PLUGIN_SETTING(9)
+#define PROBE_PLUGIN_FEED_MIN_SETTING PROBE_PLUGIN_SETTING(10)
+#define PROBE_PLUGIN_FEED_MAX_SETTING PROBE_PLUGIN_SETTING(11)
+#define PROBE_PLUGIN_PROBE_ACCEL_SETTING PROBE_PLUGIN_SETTING(12)
+#define PROBE_PLUGIN_SOURCE2_PORT_SETTING PROBE_PLUGIN_SETTING(13)
+#define PROBE_PLUGIN_SOURCE2_FLAGS_SETTING PROBE_PLUGIN_SETTING(14)
+#define PROBE_PLUGIN_SOURCE2_TOOL_SETTING PROBE_PLUGIN_SETTING(15)
+#define PROBE_PLUGIN_SOURCE3_PORT_SETTING PROBE_PLUGIN_SETTING(16)
+#define PROBE_PLUGIN_SOURCE3_FLAGS_SETTING PROBE_PLUGIN_SETTING(17)
+#define PROBE_PLUGIN_SOURCE3_TOOL_SETTING PROBE_PLUGIN_SETTING(18)
+#define PROBE_PLUGIN_TIP_DIAMETER_SETTING PROBE_PLUGIN_SETTING(19)
+#define PROBE_PLUGIN_CONNECT_MACRO_SETTING PROBE_PLUGIN_SETTING(20)
+#define PROBE_PLUGIN_DISCONNECT_MACRO_SETTING PROBE_PLUGIN_SETTING(21)
+#define PROBE_PLUGIN_SPINDOWN_SETTING PROBE_PLUGIN_SETTING(22)
+#define PROBE_PLUGIN_HEARTBEAT_SETTING PROBE_PLUGIN_SETTING(23)
+#define PROBE_PLUGIN_CACHE_CLEARANCE_SETTING PROBE_PLUGIN_SETTING(24)
+
+#define PROBE_CYCLE_RETRACT 2.0f    // mm - default back off distance between stages
+#define PROBE_CYCLE_MAX_REPEATS 20  // max number of slow probes per point
+#define PROBE_STATS_MAX_REPEATS 100 // max number of probes for M406
+
+#define PROBE_TLR_TOOLS 8 // number of measured tool length offsets kept in NVS
+#define PROBE_TOOL_CACHE_SIZE 16    // number of tools in the measured tool length cache
+#define PROBE_CACHE_CLEARANCE 2.0f  // mm - default, the cached tool approach stops this far above the expected contact
+#define PROBE_CACHE_TOLERANCE 0.05f // mm - verification touch deviation reported as a changed tool length
+#define PROBE_FEED_MARGIN 0.8f      // adaptive feed targets this fraction of the overtravel limit
+#define PROBE_FEED_MAX_STEP 1.25f   // max adaptive feed increase per probe
+#define PROBE_FEED_HYSTERESIS 0.05f // relative change required before a tuned feed is written to NVS
+
+#define CONNECTED_REPORT_INTERVAL 100 // ms - default minimum time between probe connected messages
 
 
 
@@ -66,8 +179,8 @@ typedef union {
         tool_pin       :1,
         tool_pin_inv   :1,
         motion_protect :1,
-        t99_protect    :1,      
-        reserved       :1;
+        t99_protect    :1,
+        protect_irq    :1;
     };
 } probe_protect_flags_t;
 
@@ -83,13 +196,264 @@ typedef union {
     };
 } probe_connected_flags_t;
 
+typedef union {
+    uint8_t value;
+    struct {
+        uint8_t
+        rt_report   :1,
+        persist_tlr :1,
+        tool_cache  :1,
+        tool_zone   :1,
+        binary_report :1,
+        spindown_interlock :1,
+        heartbeat   :1,
+        reserved    :1;
+    };
+} probe_protect_options_t;
+
+// Additional probe sources on aux inputs, the toolsetter keeps its original settings.
+typedef union {
+    uint8_t value;
+    struct {
+        uint8_t
+        enabled     :1,
+        invert      :1,
+        at_g59_3    :1, // used for tool probing at G59.3 instead of the toolsetter
+        by_tool     :1, // selected by tool number, at G59.3 only for that tool if at_g59_3 is set
+        ext_connect :1, // connected state taken from the probe connected sources
+        reserved    :3;
+    };
+} probe_source_flags_t;
+
+typedef struct {
+    uint8_t port;
+    probe_source_flags_t flags;
+    uint16_t tool;
+} probe_source_settings_t;
+
 typedef struct {
     uint8_t protect_port;
     uint8_t tool_port;
     probe_protect_flags_t flags;
     uint16_t debounce;
+    uint8_t protect_irq_port;
+    uint16_t connect_debounce;
+    uint16_t report_interval;
+    probe_protect_options_t options;
+    uint16_t cache_max_age;         // minutes, 0 - no limit
+    uint16_t cache_max_spindle;     // minutes of spindle run time, 0 - no limit
+    float zone_radius;              // mm, XY half size of the keep-out box around G59.3
+    float zone_height;              // mm, top of the keep-out box relative to G59.3 Z
+    float overtravel_limit;         // mm, 0 - adaptive probing feed disabled
+    float feed_min;                 // mm/min, adaptive probing feed range
+    float feed_max;
+    uint16_t probe_accel;           // percent of the axis acceleration used for probing moves, 100 - unchanged
+    probe_source_settings_t source[2]; // ProbeSource_Toolsetter2 and ProbeSource_Wireless
+    float tip_diameter;             // mm, probe stylus ball diameter used by the M408 cycles
+    uint16_t spindown_time;         // milliseconds from spindle off until a tool may touch the toolsetter
+    uint16_t heartbeat_timeout;     // milliseconds without a pulse on the connected input before the probe is disconnected
+    float cache_clearance;          // mm, the cached tool approach stops this far above the expected toolsetter contact
 } probe_protect_settings_t;
 
+// Connect/disconnect macros, stored in their own NVS block so the settings block stays small.
+typedef struct {
+    char connect[PROBE_MACRO_LENGTH + 1];
+    char disconnect[PROBE_MACRO_LENGTH + 1];
+} probe_macro_settings_t;
+
+typedef enum {
+    Debounce_Probe = 0,
+    Debounce_Connect,
+    Debounce_N
+} debounce_id_t;
+
+typedef bool (*debounce_read_ptr)(void);
+typedef void (*debounce_confirmed_ptr)(bool state);
+
+typedef enum {
+    Event_Edge = 0,         // data: debounce input id << 1 | level
+    Event_DebounceConfirm,  // data: debounce input id << 1 | level
+    Event_ProtectionOn,
+    Event_ProtectionOff,
+    Event_ConnectChange,    // data: probe connected flags
+    Event_SpindleBlocked,
+    Event_CmdStop,          // data: stop reason
+    Event_Storm,            // data: debounce input id
+    Event_SourceSelect,     // data: probe source id
+    Event_Heartbeat,        // data: heartbeat present
+    Event_N
+} trace_event_t;
+
+typedef enum {
+    Stop_ProbeProtect = 0,
+    Stop_ProbeInSpindle
+} stop_reason_t;
+
+typedef struct {
+    volatile uint32_t seq;  // sequence number + 1 of the event held, written last
+    uint32_t us;
+    uint8_t event;
+    uint8_t data;
+} trace_entry_t;
+
+// Lossy multi producer/single consumer ring, oldest events are overwritten when full.
+// Producers reserve a slot by incrementing head with interrupts disabled, the consumer (foreground) tracks tail.
+typedef struct {
+    volatile uint32_t head;
+    uint32_t tail;
+    trace_entry_t entry[PROBE_TRACE_SIZE];
+} trace_t;
+
+typedef enum {
+    ProbeSource_Touch = 0,      // main probe input
+    ProbeSource_Toolsetter,     // alternate tool probe input, or the main input if not configured
+    ProbeSource_Toolsetter2,
+    ProbeSource_Wireless,
+    ProbeSource_N
+} probe_source_t;
+
+// Runtime state per probe source, get_state is NULL for sources not configured.
+typedef struct {
+    probe_get_state_ptr get_state;
+    bool aux;                   // read from an aux input
+    uint8_t port;
+    bool invert;
+    bool ext_connect;
+    bool latch_irq;             // aux input supports edge interrupts for trigger capture
+    xbar_t pin;                 // pin accessor, get_value is NULL if not provided by the driver
+} probe_source_entry_t;
+
+// Step position captured when the probe triggers, armed by probe_start.
+typedef struct {
+    volatile bool armed;
+    volatile bool valid;
+    probe_source_t source;
+    int32_t position[N_AXIS];   // step position at the trigger
+    int32_t final[N_AXIS];      // step position after the machine stopped
+    float overtravel;           // mm travelled after the trigger
+} probe_latch_t;
+
+// Tool length reference and measured tool offsets kept in NVS, each entry is tagged with a CRC
+// and written separately, only when its value changes.
+typedef struct {
+    int32_t reference;  // sys.tlo_reference[Z_AXIS], steps
+    uint8_t crc;
+} tlr_reference_t;
+
+typedef struct {
+    uint32_t tool_id;
+    float offset;       // mm
+    uint8_t crc;
+} tlr_tool_t;
+
+typedef struct {
+    tlr_reference_t reference;
+    tlr_tool_t tool[PROBE_TLR_TOOLS];
+} tlr_data_t;
+
+// Probing feed per source tuned from the measured overtravel, kept in NVS.
+typedef struct {
+    float feed[ProbeSource_N];  // mm/min, 0 - not tuned yet
+    uint8_t crc;
+} probe_feed_data_t;
+
+// Toolsetter contact position of recently measured tools.
+typedef struct {
+    uint32_t tool_id;       // 0 - free
+    float contact;          // machine Z position of the toolsetter contact, mm
+    uint32_t ms;            // time of measurement
+    uint32_t spindle_ms;    // spindle run time at measurement
+    bool expired;           // restored from NVS, only used to check the next measurement
+} tool_cache_t;
+
+// Keep-out box around the toolsetter in machine coordinates, computed from G59.3 before each checked move.
+typedef struct {
+    bool enabled;
+    float min[3];
+    float max[3];
+} tool_zone_t;
+
+// Parameters for probing cycles executed by the plugin.
+typedef struct {
+    float fast_feed;            // mm/min, seek
+    float slow_feed;            // mm/min, fine probe
+    float retract;              // mm, back off distance after each touch
+    uint_fast8_t repeats;       // number of fine probes
+} probe_cycle_t;
+
+// Surface map, heights are stored in micrometers relative to the clearance height.
+// The first point (z[0]) is always probed first and is the reference for reported heights.
+typedef struct {
+    uint16_t nx, ny;
+    uint16_t probed;
+    float pitch[2];
+    float origin[N_AXIS];   // machine position of the first point at clearance height
+    int16_t z[PROBE_MAP_SIZE];
+} probe_map_t;
+
+typedef enum {
+    ProbeCycle_Bore = 0,
+    ProbeCycle_Boss,
+    ProbeCycle_Edge,
+    ProbeCycle_OutsideCorner,
+    ProbeCycle_InsideCorner,
+    ProbeCycle_N
+} probe_cycle_type_t;
+
+// Connect/disconnect macro split into lines when the settings are loaded.
+typedef struct {
+    char text[PROBE_MACRO_LENGTH + 1];
+    char *line[PROBE_MACRO_LINES];
+    uint_fast8_t lines;
+} probe_macro_t;
+
+typedef struct {
+    int32_t position[N_AXIS];
+    uint8_t flags;
+} scan_sample_t;
+
+// Scan samples, written by the stepper ISR and streamed by the foreground.
+typedef struct {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t overruns;
+    bool active;
+    bool deflected;
+    uint_fast8_t axis;          // dominant axis of the scan move, used for the distance interval
+    int32_t interval_steps;     // 0 - no distance sampling
+    uint32_t interval_ms;       // 0 - no time sampling
+    int32_t last_position;
+    uint32_t last_ms;
+    scan_sample_t sample[PROBE_SCAN_SIZE];
+} scan_t;
+
+// Running (Welford) statistics per axis, values are relative to the first sample to preserve precision.
+typedef struct {
+    uint32_t n;
+    float base[N_AXIS];
+    float mean[N_AXIS];
+    float m2[N_AXIS];
+    float min[N_AXIS];
+    float max[N_AXIS];
+} probe_stats_t;
+
+// Debounce state per input. Raw edges only latch the time of the first edge in a window and are counted,
+// the input is sampled once the window has expired and a change is reported at most once per window.
+typedef struct {
+    volatile bool pending;
+    volatile uint32_t edge_ms;
+    volatile uint32_t edges;            // total number of edges
+    volatile uint16_t window_edges;     // edges in the current window
+    uint16_t max_window_edges;
+    uint16_t storms;                    // number of windows with PROBE_STORM_EDGES or more edges
+    bool storm;
+    bool state;
+    uint16_t window;
+    const char *name;
+    debounce_read_ptr read;
+    debounce_confirmed_ptr confirmed;
+} debounce_input_t;
+
 //static probe_state_t probe = {
 //    .connected = Off
 //};
@@ -100,16 +464,42 @@ static probe_state_t prev_probe;
 
 static uint8_t probe_connect_port;
 static uint8_t tool_probe_port;
-static bool nvs_invert_probe_pin, protection_enabled = false;
+static uint8_t protect_irq_port;
+static bool nvs_invert_probe_pin, protection_enabled = false, protect_irq_ok = false;
+static probe_latch_t latch = {0};
+static bool cycle_active = false;
+static tool_cache_t tool_cache[PROBE_TOOL_CACHE_SIZE] = {0};
+static uint32_t fixture_tool_id = 0, spindle_on_ms, spindle_off_ms = 0, spindle_total_ms = 0;
+static bool fixture_approach = false, fixture_active = false, spindle_running = false, probing = false;
+static tool_zone_t tool_zone = {0};
+static float zone_start[N_AXIS];    // machine position at the end of the last planned move
+static bool zone_start_valid = false;
+static probe_map_t probe_map = {0};
+static scan_t scan = {0};
+static stepper_pulse_start_ptr scan_pulse_start = NULL;
+static travel_limits_ptr check_travel_limits;
+static jog_limits_ptr apply_jog_limits;
+static on_state_change_ptr on_state_change;
 static uint8_t nvs_hardlimits;
 static probe_connected_flags_t probe_connected;
 static driver_reset_ptr driver_reset;
 static user_mcode_ptrs_t user_mcode;
 
-static nvs_address_t nvs_address;
+static nvs_address_t nvs_address, tlr_address = 0, feed_address = 0, macro_address = 0;
+static probe_feed_data_t probe_feed = {0};
+static float probe_feed_used = 0.0f;
+static bool probe_feed_seek = false; // the next probe move is a plugin cycle seek, run at the tuned feed
+static float saved_accel[N_AXIS];
+static axes_signals_t accel_axes = {0}; // axes running at the probing acceleration
+static axes_signals_t probe_axes = {0};  // axes of the probe move announced by on_probe_start
+static float probe_target[N_AXIS];       // target of the probe move announced by on_probe_start
+static bool probe_pending = false;       // on_probe_start accepted a probe move, set up when the core arms the probe
+static tlr_data_t tlr;
+static uint_fast8_t tlr_next = 0;
 static on_report_options_ptr on_report_options;
 //static probe_connected_toggle_ptr probe_connected_toggle;
 static probe_protect_settings_t probe_protect_settings;
+static probe_macro_settings_t macro_settings;
 static on_probe_start_ptr on_probe_start;
 static on_probe_completed_ptr on_probe_completed;
 static on_probe_toolsetter_ptr on_probe_fixture;
@@ -118,41 +508,326 @@ static stepper_pulse_start_ptr stepper_pulse_start;
 static spindle_set_state_ptr on_spindle_set_state = NULL;
 static on_tool_selected_ptr on_tool_selected = NULL;
 static on_tool_changed_ptr on_tool_changed = NULL; 
-static probe_get_state_ptr probe_get_state = NULL;
+static probe_get_state_ptr core_probe_get_state = NULL;
+static probe_source_entry_t probe_source[ProbeSource_N] = {0};
+static volatile probe_source_t probe_selected = ProbeSource_Touch;
+static probe_source_t probe_base = ProbeSource_Touch; // source used outside toolsetter probing
+static bool probe_manual = false;
 static probe_configure_ptr on_probe_configure = NULL;
+static on_execute_realtime_ptr on_execute_realtime;
+static on_realtime_report_ptr on_realtime_report;
+static probe_macro_t connect_macro = {0}, disconnect_macro = {0};
+static probe_macro_t *macro_running = NULL;
+static uint_fast8_t macro_line = 0;
+static bool connected_report_pending = false;
+static uint8_t connected_reported = 0;
+static uint32_t connected_report_ms;
+static debounce_input_t debounce[Debounce_N];
+static trace_t trace = {0};
+
+static const char *const event_name[Event_N] = {
+    "edge",
+    "confirm",
+    "protect_on",
+    "protect_off",
+    "connected",
+    "spindle_blocked",
+    "stop",
+    "storm",
+    "source",
+    "heartbeat"
+};
 
 static void set_connected_status(void *data);
+static bool cycle_move (float *target, float feed_rate);
+
+#if PROBE_PLUGIN_METRICS
+
+typedef enum {
+    Hook_PulseStart = 0,
+    Hook_ProbeStart,
+    Hook_ProbeCompleted,
+    Hook_ProbeFixture,
+    Hook_SpindleSetState,
+    Hook_ToolSelected,
+    Hook_MCodeExecute,
+    Hook_N
+} hook_id_t;
+
+typedef struct {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t bucket[PROBE_METRICS_BUCKETS];
+} hook_metrics_t;
+
+static const char *const hook_name[Hook_N] = {
+    "pulse_start",
+    "probe_start",
+    "probe_completed",
+    "probe_fixture",
+    "spindle_set_state",
+    "tool_selected",
+    "mcode_execute"
+};
+
+// Updated from the context the hook runs in, a report may see a sample partially updated.
+static hook_metrics_t metrics[Hook_N];
 
-//returns true if probe is connected and sets core variable.
-static void check_connected_pin (void)
+ISR_CODE static void metrics_add (hook_id_t hook, uint32_t elapsed)
 {
-    uint8_t val;
+    uint_fast8_t idx = 0;
+    hook_metrics_t *m = &metrics[hook];
+
+    if(m->count == 0 || elapsed < m->min)
+        m->min = elapsed;
+    if(elapsed > m->max)
+        m->max = elapsed;
+    m->sum += elapsed;
+    m->count++;
+
+    while(idx < PROBE_METRICS_BUCKETS - 1 && elapsed >= (1UL << idx))
+        idx++;
+    m->bucket[idx]++;
+}
 
-    if(probe_protect_settings.flags.ext_pin){
-        //hal.delay_ms(RELAY_DEBOUNCE, NULL); // Delay a bit to let any contact bounce settle.
-        val = hal.port.wait_on_input(Port_Digital, probe_connect_port, WaitMode_Immediate, 0.0f);//read the IO pin        
-        if(val == 1)
-            probe_connected.ext_pin = true;
-        else
-            probe_connected.ext_pin = false;
+// Only the plugin's own code is measured, stop timing before continuing the call chain.
+#define METRICS_START() uint32_t metrics_t0 = PROBE_METRICS_TIMESTAMP()
+#define METRICS_END(hook) metrics_add(hook, PROBE_METRICS_TIMESTAMP() - metrics_t0)
+
+#else
+#define METRICS_START()
+#define METRICS_END(hook)
+#endif
+
+// Handler variants are generated from the templates below, one per combination of the flags they depend on,
+// and selected when settings are loaded so the handlers themselves do not test settings flags.
+
+//reads the external connected pin and sets the ext_pin flag, variant per ext_pin_inv.
+#define CHECK_CONNECTED_PIN_VARIANT(name, inv) \
+static void name (void) \
+{ \
+    probe_connected.ext_pin = (hal.port.wait_on_input(Port_Digital, probe_connect_port, WaitMode_Immediate, 0.0f) == 1) != inv; \
+}
+
+static void check_connected_none (void)
+{
+}
+
+static volatile uint32_t heartbeat_ms = 0;
+static bool heartbeat_alive = false;
+
+//wireless probe receivers pulsing the connected input, connected while pulses keep arriving.
+static void check_connected_heartbeat (void)
+{
+    probe_connected.ext_pin = heartbeat_alive;
+}
+
+CHECK_CONNECTED_PIN_VARIANT(check_connected_pin_high, 0)
+CHECK_CONNECTED_PIN_VARIANT(check_connected_pin_low, 1)
+
+// [ext_pin][ext_pin_inv]
+static void (*const check_connected_variant[2][2])(void) = {
+    { check_connected_none, check_connected_none },
+    { check_connected_pin_high, check_connected_pin_low }
+};
+
+//sets the ext_pin flag if the external connected pin is enabled and asserted.
+static void (*check_connected_pin)(void) = check_connected_none;
+
+ISR_CODE static uint32_t trace_timestamp (void)
+{
+    return hal.get_micros ? hal.get_micros() : hal.get_elapsed_ticks() * 1000;
+}
+
+// Add an event to the trace, safe to call from any ISR but not with interrupts already disabled.
+// Only the slot reservation is a critical section, atomic read-modify-write is not available on all MCUs (Cortex-M0+).
+ISR_CODE static void trace_add (trace_event_t event, uint8_t data)
+{
+    uint32_t seq;
+    trace_entry_t *entry;
+
+    hal.irq_disable();
+    seq = trace.head++;
+    hal.irq_enable();
+
+    entry = &trace.entry[seq & (PROBE_TRACE_SIZE - 1)];
+
+    entry->seq = 0;
+    entry->us = trace_timestamp();
+    entry->event = (uint8_t)event;
+    entry->data = data;
+    __atomic_store_n(&entry->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+// Copy the event with sequence number seq, returns false if not yet written or already overwritten.
+static bool trace_get (uint32_t seq, trace_entry_t *event)
+{
+    trace_entry_t *entry = &trace.entry[seq & (PROBE_TRACE_SIZE - 1)];
+
+    if(__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) != seq + 1)
+        return false;
 
-        if(probe_protect_settings.flags.ext_pin_inv)
-            probe_connected.ext_pin = !probe_connected.ext_pin;
+    event->us = entry->us;
+    event->event = entry->event;
+    event->data = entry->data;
+
+    return __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) == seq + 1;
+}
+
+// Called from the foreground, consumes new events and outputs messages for those the operator should see.
+static void trace_drain (void)
+{
+    trace_entry_t event;
+    uint32_t head = __atomic_load_n(&trace.head, __ATOMIC_ACQUIRE);
+
+    if(head - trace.tail > PROBE_TRACE_SIZE)
+        trace.tail = head - PROBE_TRACE_SIZE; // consumer lapped, skip lost events
+
+    while(trace.tail != head && trace_get(trace.tail, &event)) {
+        trace.tail++;
+        if(event.event == Event_CmdStop)
+            report_message(event.data == Stop_ProbeInSpindle ? "PROBE IS IN SPINDLE!" : "PROBE PROTECTED!", Message_Warning);
+    }
+}
+
+// Register a raw edge, safe to call from any ISR. Only the first edge in a window is traced,
+// further edges are counted so a chattering input can not flood the trace.
+ISR_CODE static void debounce_edge (debounce_id_t id, bool level)
+{
+    debounce[id].edges++;
+    debounce[id].window_edges++;
+
+    if(!debounce[id].pending) {
+        debounce[id].edge_ms = hal.get_elapsed_ticks();
+        debounce[id].pending = true;
+        trace_add(Event_Edge, (id << 1) | level);
     }
 }
 
+static void warning_storm (void *data)
+{
+    char msg[64];
+
+    strcpy(msg, "Probe plugin: interrupt storm on ");
+    strcat(msg, ((debounce_input_t *)data)->name);
+    strcat(msg, " input, check wiring");
+    report_message(msg, Message_Warning);
+}
+
+//updates the edge statistics at the end of a window.
+static void debounce_storm_check (debounce_id_t id)
+{
+    debounce_input_t *input = &debounce[id];
+    uint16_t edges = input->window_edges;
+
+    input->window_edges = 0;
+
+    if(edges > input->max_window_edges)
+        input->max_window_edges = edges;
+
+    if(edges >= PROBE_STORM_EDGES) {
+        if(!input->storm) {
+            input->storm = true;
+            input->storms++;
+            trace_add(Event_Storm, id);
+            task_add_immediate(warning_storm, input);
+        }
+    } else
+        input->storm = false;
+}
+
+// Resynchronize the confirmed state with the input, drops any pending edge.
+static void debounce_sync (debounce_id_t id)
+{
+    debounce[id].pending = false;
+    debounce[id].state = debounce[id].read();
+}
+
+// Called from the foreground, samples inputs with an expired window and reports changes.
+static void debounce_poll (void)
+{
+    bool state;
+    uint_fast8_t idx = Debounce_N;
+    uint32_t ms = hal.get_elapsed_ticks();
+
+    do {
+        debounce_input_t *input = &debounce[--idx];
+        if(input->pending && (ms - input->edge_ms) >= input->window) {
+            input->pending = false;
+            debounce_storm_check((debounce_id_t)idx);
+            if((state = input->read()) != input->state) {
+                input->state = state;
+                trace_add(Event_DebounceConfirm, (idx << 1) | state);
+                input->confirmed(state);
+            }
+        }
+    } while(idx);
+}
+
+static bool connect_read (void)
+{
+    check_connected_pin();
+
+    return probe_connected.ext_pin;
+}
+
+static void connect_confirmed (bool state)
+{
+    set_connected_status(NULL);
+}
+
 ISR_CODE static void set_connected (uint8_t irq_port, bool is_high)
 {
-    task_add_immediate(set_connected_status, NULL);    
+    debounce_edge(Debounce_Connect, is_high);
+}
+
+//heartbeat mode, only the time of the last pulse edge is recorded.
+ISR_CODE static void on_heartbeat (uint8_t irq_port, bool is_high)
+{
+    heartbeat_ms = hal.get_elapsed_ticks();
+}
+
+//checks the heartbeat timeout from the realtime loop, a lost heartbeat disconnects the probe.
+static void heartbeat_poll (void)
+{
+    bool alive;
+
+    if(check_connected_pin != check_connected_heartbeat)
+        return;
+
+    if((alive = (hal.get_elapsed_ticks() - heartbeat_ms) < probe_protect_settings.heartbeat_timeout) != heartbeat_alive) {
+        heartbeat_alive = alive;
+        trace_add(Event_Heartbeat, alive);
+        if(!alive && probe_connected.ext_pin)
+            report_message("Probe plugin: probe heartbeat lost", Message_Warning);
+        set_connected_status(NULL);
+    }
 }
 
 static user_mcode_type_t mcode_check (user_mcode_t mcode)
 {
-    return mcode == (user_mcode_t)401 || mcode == (user_mcode_t)402
-                     ? mcode
-                     : (user_mcode.check ? user_mcode.check(mcode) : UserMCode_Unsupported);
+    switch((uint16_t)mcode) {
+
+        case 401:
+        case 402:
+        case 403:
+        case 404:
+        case 405:
+        case 406:
+        case 407:
+        case 408:
+        case 409:
+            return UserMCode_Normal;
+
+        default:
+            return user_mcode.check ? user_mcode.check(mcode) : UserMCode_Unsupported;
+    }
 }
 
+// The words are cleared once checked so the parser does not report them as unused, they are not available
+// when the command is executed. Optional words that are absent have a zero value.
 static status_code_t mcode_validate (parser_block_t *gc_block)
 {
     status_code_t state = Status_OK;
@@ -165,6 +840,124 @@ static status_code_t mcode_validate (parser_block_t *gc_block)
         case 402:
             break;
 
+        case 403:
+            if(!(gc_block->words.i || gc_block->words.j || gc_block->words.k) || !gc_block->words.p)
+                state = Status_GcodeValueWordMissing;
+            else if(gc_block->values.p <= 0.0f ||
+                     (gc_block->values.ijk[0] == 0.0f && gc_block->values.ijk[1] == 0.0f && gc_block->values.ijk[2] == 0.0f) ||
+                     (gc_block->words.q && gc_block->values.q <= 0.0f) ||
+                     (gc_block->words.r && gc_block->values.r <= 0.0f) ||
+                     (gc_block->words.l && (gc_block->values.l < 1 || gc_block->values.l > PROBE_CYCLE_MAX_REPEATS)))
+                state = Status_GcodeValueOutOfRange;
+            gc_block->words.i = gc_block->words.j = gc_block->words.k = Off;
+            gc_block->words.p = gc_block->words.q = gc_block->words.r = gc_block->words.l = Off;
+            gc_block->user_mcode_sync = On;
+            break;
+
+        case 404:
+            if(gc_block->words.p && (gc_block->values.p < 0.0f || gc_block->values.p != truncf(gc_block->values.p)))
+                state = Status_GcodeValueOutOfRange;
+            gc_block->words.p = Off;
+            break;
+
+        case 405:
+            if(!(gc_block->words.i && gc_block->words.j && gc_block->words.k && gc_block->words.p && gc_block->words.q))
+                state = Status_GcodeValueWordMissing;
+            else if(gc_block->values.f <= 0.0f)
+                state = Status_GcodeUndefinedFeedRate;
+            else if(gc_block->values.p < 1.0f || gc_block->values.p != truncf(gc_block->values.p) ||
+                     gc_block->values.q < 1.0f || gc_block->values.q != truncf(gc_block->values.q) ||
+                      gc_block->values.p * gc_block->values.q > (float)PROBE_MAP_SIZE ||
+                       gc_block->values.ijk[Z_AXIS] <= 0.0f || gc_block->values.ijk[Z_AXIS] > 32.0f ||
+                        (gc_block->values.p > 1.0f && gc_block->values.ijk[0] == 0.0f) ||
+                         (gc_block->values.q > 1.0f && gc_block->values.ijk[1] == 0.0f))
+                state = Status_GcodeValueOutOfRange;
+            gc_block->words.i = gc_block->words.j = gc_block->words.k = Off;
+            gc_block->words.p = gc_block->words.q = Off;
+            gc_block->user_mcode_sync = On;
+            break;
+
+        case 406:
+            if(!(gc_block->words.i || gc_block->words.j || gc_block->words.k) || !gc_block->words.p || !gc_block->words.l)
+                state = Status_GcodeValueWordMissing;
+            else if(gc_block->values.p <= 0.0f ||
+                     (gc_block->values.ijk[0] == 0.0f && gc_block->values.ijk[1] == 0.0f && gc_block->values.ijk[2] == 0.0f) ||
+                     (gc_block->words.r && gc_block->values.r <= 0.0f) ||
+                     gc_block->values.l < 2 || gc_block->values.l > PROBE_STATS_MAX_REPEATS)
+                state = Status_GcodeValueOutOfRange;
+            gc_block->words.i = gc_block->words.j = gc_block->words.k = Off;
+            gc_block->words.p = gc_block->words.r = gc_block->words.l = Off;
+            gc_block->user_mcode_sync = On;
+            break;
+
+        case 407:
+            if(gc_block->words.p && (gc_block->values.p < 0.0f || gc_block->values.p >= (float)ProbeSource_N ||
+                                      gc_block->values.p != truncf(gc_block->values.p) ||
+                                       probe_source[(uint_fast8_t)gc_block->values.p].get_state == NULL))
+                state = Status_GcodeValueOutOfRange;
+            else if(!gc_block->words.p)
+                gc_block->values.p = -1.0f; // automatic selection, P0 selects the main probe
+            gc_block->words.p = Off;
+            gc_block->user_mcode_sync = On;
+            break;
+
+        case 408:
+            if(!gc_block->words.p)
+                state = Status_GcodeValueWordMissing;
+            else if(gc_block->values.f <= 0.0f)
+                state = Status_GcodeUndefinedFeedRate;
+            else if(gc_block->values.p < 0.0f || gc_block->values.p >= (float)ProbeCycle_N || gc_block->values.p != truncf(gc_block->values.p) ||
+                     (gc_block->words.q && (gc_block->values.q < 1.0f || gc_block->values.q > 6.0f || gc_block->values.q != truncf(gc_block->values.q))) ||
+                      (gc_block->words.r && gc_block->values.r <= 0.0f))
+                state = Status_GcodeValueOutOfRange;
+            else switch((probe_cycle_type_t)gc_block->values.p) {
+
+                case ProbeCycle_Boss:
+                    if(!gc_block->words.k)
+                        state = Status_GcodeValueWordMissing;
+                    else if(gc_block->values.ijk[Z_AXIS] <= 0.0f)
+                        state = Status_GcodeValueOutOfRange;
+                    // fall through
+                case ProbeCycle_Bore:
+                    if(!gc_block->words.i)
+                        state = Status_GcodeValueWordMissing;
+                    else if(gc_block->values.ijk[0] <= 0.0f || (gc_block->words.j && gc_block->values.ijk[1] <= 0.0f))
+                        state = Status_GcodeValueOutOfRange;
+                    break;
+
+                case ProbeCycle_Edge:
+                    if(!(gc_block->words.i || gc_block->words.j || gc_block->words.k))
+                        state = Status_GcodeValueWordMissing;
+                    else if(gc_block->values.ijk[0] == 0.0f && gc_block->values.ijk[1] == 0.0f && gc_block->values.ijk[2] == 0.0f)
+                        state = Status_GcodeValueOutOfRange;
+                    break;
+
+                default: // corners
+                    if(!(gc_block->words.i && gc_block->words.j))
+                        state = Status_GcodeValueWordMissing;
+                    else if(gc_block->values.ijk[0] == 0.0f || gc_block->values.ijk[1] == 0.0f)
+                        state = Status_GcodeValueOutOfRange;
+                    break;
+            }
+            gc_block->words.i = gc_block->words.j = gc_block->words.k = Off;
+            gc_block->words.p = gc_block->words.q = gc_block->words.r = Off;
+            gc_block->user_mcode_sync = On;
+            break;
+
+        case 409:
+            if(!(gc_block->words.i || gc_block->words.j || gc_block->words.k))
+                state = Status_GcodeValueWordMissing;
+            else if(gc_block->values.f <= 0.0f)
+                state = Status_GcodeUndefinedFeedRate;
+            else if((gc_block->values.ijk[0] == 0.0f && gc_block->values.ijk[1] == 0.0f && gc_block->values.ijk[2] == 0.0f) ||
+                     (gc_block->words.p && gc_block->values.p <= 0.0f) ||
+                      (gc_block->words.q && (gc_block->values.q < 1.0f || gc_block->values.q != truncf(gc_block->values.q))))
+                state = Status_GcodeValueOutOfRange;
+            gc_block->words.i = gc_block->words.j = gc_block->words.k = Off;
+            gc_block->words.p = gc_block->words.q = Off;
+            gc_block->user_mcode_sync = On;
+            break;
+
         default:
             state = Status_Unhandled;
             break;
@@ -173,54 +966,204 @@ static status_code_t mcode_validate (parser_block_t *gc_block)
     return state == Status_Unhandled && user_mcode.validate ? user_mcode.validate(gc_block) : state;
 }
 
-// local redirected probing function for tool probe pin.
-static probe_state_t probeGetState (void)
+// Capture the current step position as the trigger position, called from ISR context.
+ISR_CODE static void latch_capture (void)
+{
+    if(latch.armed) {
+        latch.armed = false;
+        memcpy(latch.position, (void *)sys.position, sizeof(latch.position));
+        latch.valid = true;
+    }
+}
+
+// generic read of the tool probe pin.
+#define TOOL_PROBE_READ() (hal.port.wait_on_input(Port_Digital, tool_probe_port, WaitMode_Immediate, 0.0f) != 0)
+// direct read via the pin accessor resolved when the port was claimed.
+#define TOOL_PROBE_READ_DIRECT() (tool_probe_pin.get_value(&tool_probe_pin) != 0.0f)
+
+static xbar_t tool_probe_pin;
+
+// local redirected probing function for tool probe pin, variant per read method and tool_pin_inv.
+#define PROBE_GET_STATE_VARIANT(name, read, inv) \
+static probe_state_t name (void) \
+{ \
+    probe_state_t state = {0}; \
+\
+    state.connected = On; /* tool setter is fixed and always connected. */ \
+    state.triggered = read() != inv; \
+\
+    if(state.triggered && latch.armed) /* fallback capture when no edge interrupt is available. */ \
+        latch_capture(); \
+\
+    return state; \
+}
+
+PROBE_GET_STATE_VARIANT(probeGetState, TOOL_PROBE_READ, 0)
+PROBE_GET_STATE_VARIANT(probeGetStateInv, TOOL_PROBE_READ, 1)
+PROBE_GET_STATE_VARIANT(probeGetStateDirect, TOOL_PROBE_READ_DIRECT, 0)
+PROBE_GET_STATE_VARIANT(probeGetStateDirectInv, TOOL_PROBE_READ_DIRECT, 1)
+
+// [direct][tool_pin_inv]
+static const probe_get_state_ptr probe_get_state_variant[2][2] = {
+    { probeGetState, probeGetStateInv },
+    { probeGetStateDirect, probeGetStateDirectInv }
+};
+
+// Resolve a claimed aux input port to the driver's pin accessor,
+// returns false if the driver does not provide one.
+static bool pin_resolve (uint8_t port, xbar_t *pin)
+{
+    xbar_t *info;
+
+    if(hal.port.get_pin_info && (info = hal.port.get_pin_info(Port_Digital, Port_Input, port)) && info->get_value) {
+        memcpy(pin, info, sizeof(xbar_t)); // the driver may return a pointer to a shared struct.
+        return true;
+    }
+
+    pin->get_value = NULL;
+
+    return false;
+}
+
+static probe_get_state_ptr tool_probe_get_state = probeGetState;
+
+// read of the additional aux input probe sources.
+static probe_state_t probe_source_read (probe_source_t id)
 {
     probe_state_t state = {0};
+    probe_source_entry_t *source = &probe_source[id];
 
-    state.connected = On; //tool setter is fixed and always connected.  Maybe add some error handling here?
-    state.triggered = hal.port.wait_on_input(Port_Digital, tool_probe_port, WaitMode_Immediate, 0.0f);//read the IO pin
+    state.connected = source->ext_connect ? probe_connected.value != 0 : On;
+    state.triggered = (source->pin.get_value
+                        ? source->pin.get_value(&source->pin) != 0.0f
+                        : hal.port.wait_on_input(Port_Digital, source->port, WaitMode_Immediate, 0.0f) != 0) != source->invert;
 
-    if(probe_protect_settings.flags.tool_pin_inv)
-        state.triggered = !state.triggered;   
+    if(state.triggered && latch.armed)
+        latch_capture();
 
     return state;
 }
 
-//called after short delay to verify that a rising edge on the probe pin is still asserted
-static void protect_debounce_cb(void){
-    probe_state_t probe = hal.probe.get_state();
+static probe_state_t toolsetter2GetState (void)
+{
+    return probe_source_read(ProbeSource_Toolsetter2);
+}
+
+static probe_state_t wirelessGetState (void)
+{
+    return probe_source_read(ProbeSource_Wireless);
+}
+
+// Probe sources are selected by index. hal.probe.get_state permanently points to the router so
+// switching is a single store and a reset in the middle of a probe move can not leave a stale pointer behind.
+static probe_state_t probe_router (void)
+{
+    return probe_source[probe_selected].get_state();
+}
+
+static bool probe_select (probe_source_t id)
+{
+    if(id >= ProbeSource_N || probe_source[id].get_state == NULL)
+        return false;
+
+    if(probe_selected != id) {
+        probe_selected = id;
+        trace_add(Event_SourceSelect, id);
+    }
 
-    if (probe.triggered) { // Check probe state.  Alarm if still asserted.
+    return true;
+}
+
+static inline probe_source_settings_t *probe_source_settings (probe_source_t id)
+{
+    return &probe_protect_settings.source[id - ProbeSource_Toolsetter2];
+}
+
+//source to use outside toolsetter probing: the first source selected by the tool number, else the main probe.
+static probe_source_t probe_tool_source (uint32_t tool_id)
+{
+    probe_source_t id;
+    probe_source_settings_t *cfg;
+
+    for(id = ProbeSource_Toolsetter2; id < ProbeSource_N; id++) {
+        cfg = probe_source_settings(id);
+        if(probe_source[id].get_state && cfg->flags.by_tool && !cfg->flags.at_g59_3 && cfg->tool == tool_id)
+            return id;
+    }
+
+    return ProbeSource_Touch;
+}
+
+//source to use for tool probing at G59.3.
+static probe_source_t probe_fixture_source (uint32_t tool_id)
+{
+    probe_source_t id;
+    probe_source_settings_t *cfg;
+
+    for(id = ProbeSource_Toolsetter2; id < ProbeSource_N; id++) {
+        cfg = probe_source_settings(id);
+        if(probe_source[id].get_state && cfg->flags.at_g59_3 && (!cfg->flags.by_tool || cfg->tool == tool_id))
+            return id;
+    }
+
+    return ProbeSource_Toolsetter;
+}
+
+static bool probe_read (void)
+{
+    return hal.probe.get_state().triggered;
+}
+
+//called when the probe state has been stable for the debounce window.
+static void probe_confirmed (bool triggered)
+{
+    if (triggered && protection_enabled) { // Alarm if still asserted.
         grbl.enqueue_realtime_command(CMD_STOP);
-        report_message("PROBE PROTECTED!", Message_Warning);
+        trace_add(Event_CmdStop, Stop_ProbeProtect);
     }    
 }
 
 static void on_pulse_start (stepper_t *stepper){
 
+    METRICS_START();
+
     probe_state_t probe = hal.probe.get_state();
 
     //if ((!prev_probe.triggered && probe.triggered) || !probe.connected) { // if probe has a rising edge from last pulse or is disconnected.
-    if ((!prev_probe.triggered && probe.triggered)) { // if probe has a rising edge from last pulse
-        //call debounce callback
-        hal.delay_ms(PROBE_DEBOUNCE, protect_debounce_cb);
+    if (prev_probe.triggered != probe.triggered) { // if probe has changed since last pulse
+        prev_probe.triggered = probe.triggered;
+        debounce_edge(Debounce_Probe, probe.triggered);
     }
 
-    prev_probe.triggered = probe.triggered;
+    METRICS_END(Hook_PulseStart);
     
     if(stepper_pulse_start)
         stepper_pulse_start(stepper);
 }
 
+//interrupt handler for the aux input mirroring the probe signal, only armed while protection is on.
+ISR_CODE static void on_probe_edge (uint8_t irq_port, bool is_high)
+{
+    //polarity is resolved by the debounce engine which reads the probe state again.
+    debounce_edge(Debounce_Probe, is_high);
+}
+
 static void protection_on (void){
 
     if (!protection_enabled && probe_connected.value && probe_protect_settings.flags.motion_protect){
         
         protection_enabled = On;
+        trace_add(Event_ProtectionOn, 0);
 
-        probe_state_t probe = hal.probe.get_state();
-        prev_probe.triggered = probe.triggered;
+        debounce_sync(Debounce_Probe);
+        prev_probe.triggered = debounce[Debounce_Probe].state;
+
+        if(protect_irq_ok) {
+            //edge interrupt mode, no per step cost.
+            if(hal.port.register_interrupt_handler(protect_irq_port, IRQ_Mode_Change, on_probe_edge))
+                return;
+            protect_irq_ok = false; //fall back to polling.
+        }
 
         stepper_pulse_start = hal.stepper.pulse_start;
         hal.stepper.pulse_start = on_pulse_start;   
@@ -232,6 +1175,12 @@ static void protection_off (void){
     
     if(protection_enabled && probe_protect_settings.flags.motion_protect){
         protection_enabled = Off;
+        trace_add(Event_ProtectionOff, 0);
+
+        if(protect_irq_ok) {
+            hal.port.register_interrupt_handler(protect_irq_port, IRQ_Mode_None, NULL);
+            return;
+        }
 
         if(stepper_pulse_start)
             hal.stepper.pulse_start = stepper_pulse_start;
@@ -240,162 +1189,1645 @@ static void protection_off (void){
     }
 }
 
-static bool probe_start (axes_signals_t axes, float *target, plan_line_data_t *pl_data){
-    //if probe connected, de-activate protection at the start of a probing move machine will stop on activation
-    bool status = true;
-    protection_off();
+//edge interrupt handlers capturing the trigger position while probing.
+ISR_CODE static void on_probe_latch (uint8_t irq_port, bool is_high)
+{
+    if(latch.armed && hal.probe.get_state().triggered)
+        latch_capture();
+}
 
-    if(on_probe_start)
-        status = on_probe_start(axes, target, pl_data);
-    
-    return status;
+ISR_CODE static void on_source_latch (uint8_t irq_port, bool is_high)
+{
+    if(latch.armed && probe_source[latch.source].get_state().triggered)
+        latch_capture();
 }
 
-static void probe_completed (void){
-    //re-activate protection.
-    protection_on();
+static void latch_arm (void)
+{
+    latch.valid = false;
+    latch.source = probe_selected;
+    latch.armed = true;
+
+    if(probe_source[latch.source].aux) {
+        if(probe_source[latch.source].latch_irq)
+            hal.port.register_interrupt_handler(probe_source[latch.source].port, IRQ_Mode_Change, on_source_latch);
+    } else if(protect_irq_ok)
+        hal.port.register_interrupt_handler(protect_irq_port, IRQ_Mode_Change, on_probe_latch);
+}
 
-    if(on_probe_completed)
-        on_probe_completed();
+static void latch_disarm (void)
+{
+    latch.armed = false;
+
+    if(probe_source[latch.source].latch_irq)
+        hal.port.register_interrupt_handler(probe_source[latch.source].port, IRQ_Mode_None, NULL);
+    if(protect_irq_ok && !protection_enabled)
+        hal.port.register_interrupt_handler(protect_irq_port, IRQ_Mode_None, NULL);
 }
 
-static void tool_changed (tool_data_t *tool){    
-    //tool_change.c sets grbl.on_probe_completed to NULL when finished.  Is this correct?  That breaks the call chain in this plugin.
-    //restore the pointer here.
-    
-    if(grbl.on_probe_completed == NULL){
-        on_probe_completed = grbl.on_probe_completed;
-        grbl.on_probe_completed = probe_completed;
+//replaces the core trigger position with the latched one and records the overtravel.
+static void latch_complete (void)
+{
+    uint_fast8_t idx;
+    float distance, overtravel = 0.0f;
+
+    latch_disarm();
+
+    if(!sys.flags.probe_succeeded) {
+        latch.valid = false;
+        return;
     }
 
-    //continue call chain
-    if(on_tool_changed)
-        on_tool_changed(tool);
-} 
+    if(latch.valid)
+        memcpy(sys.probe_position, latch.position, sizeof(sys.probe_position));
+    else {
+        memcpy(latch.position, sys.probe_position, sizeof(latch.position)); //core captured it from the step ISR.
+        latch.valid = true;
+    }
 
-//The grbl.on_probe_fixture event handler is called by the default tool change algorithm when probing at G59.3.
-//In addition it will be called on a "normal" probe sequence if the XY position is
+    memcpy(latch.final, sys.position, sizeof(latch.final));
+
+    for(idx = 0; idx < N_AXIS; idx++) {
+        distance = (float)(latch.final[idx] - latch.position[idx]) / settings.axis[idx].steps_per_mm;
+        overtravel += distance * distance;
+    }
+
+    latch.overtravel = sqrtf(overtravel);
+}
+
+static uint32_t spindle_run_ms (void)
+{
+    return spindle_total_ms + (spindle_running ? hal.get_elapsed_ticks() - spindle_on_ms : 0);
+}
+
+//returns the cache entry for the tool if it is still valid according to the invalidation policy, NULL if not.
+static tool_cache_t *tool_cache_get (uint32_t tool_id)
+{
+    uint_fast8_t idx;
+    tool_cache_t *entry = NULL;
+
+    if(!(tool_id && probe_protect_settings.options.tool_cache))
+        return NULL;
+
+    for(idx = 0; idx < PROBE_TOOL_CACHE_SIZE; idx++) {
+        if(tool_cache[idx].tool_id == tool_id) {
+            entry = &tool_cache[idx];
+            break;
+        }
+    }
+
+    if(entry && entry->expired)
+        return NULL;
+
+    if(entry && ((probe_protect_settings.cache_max_age && (hal.get_elapsed_ticks() - entry->ms) >= probe_protect_settings.cache_max_age * 60000UL) ||
+                  (probe_protect_settings.cache_max_spindle && (spindle_run_ms() - entry->spindle_ms) >= probe_protect_settings.cache_max_spindle * 60000UL))) {
+        entry->tool_id = 0;
+        entry = NULL;
+    }
+
+    return entry;
+}
+
+//returns the entry for the tool, else a free entry or the oldest one when full.
+static tool_cache_t *tool_cache_slot (uint32_t tool_id)
+{
+    uint_fast8_t idx;
+    tool_cache_t *entry = NULL;
+
+    for(idx = 0; idx < PROBE_TOOL_CACHE_SIZE; idx++) {
+        if(tool_cache[idx].tool_id == tool_id)
+            return &tool_cache[idx];
+        if(entry == NULL || tool_cache[idx].tool_id == 0 || (entry->tool_id && tool_cache[idx].ms - entry->ms > 0x7FFFFFFF))
+            entry = &tool_cache[idx];
+    }
+
+    return entry;
+}
+
+static void tool_cache_set (tool_cache_t *entry, uint32_t tool_id, float contact)
+{
+    entry->tool_id = tool_id;
+    entry->contact = contact;
+    entry->ms = hal.get_elapsed_ticks();
+    entry->spindle_ms = spindle_run_ms();
+    entry->expired = false;
+}
+
+//stores the toolsetter contact of the last probe at the fixture.
+static void tool_cache_store (uint32_t tool_id)
+{
+    float position[N_AXIS];
+    tool_cache_t *entry;
+
+    if(!(tool_id && latch.valid && probe_protect_settings.options.tool_cache))
+        return;
+
+    entry = tool_cache_slot(tool_id);
+
+    system_convert_array_steps_to_mpos(position, latch.position);
+
+    if(entry->tool_id == tool_id && fabsf(entry->contact - position[Z_AXIS]) > PROBE_CACHE_TOLERANCE)
+        report_message("Probe plugin: tool length differs from cached value", Message_Warning);
+
+    tool_cache_set(entry, tool_id, position[Z_AXIS]);
+}
+
+static void tool_cache_invalidate (uint32_t tool_id)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < PROBE_TOOL_CACHE_SIZE; idx++) {
+        if(tool_id == 0 || tool_cache[idx].tool_id == tool_id)
+            tool_cache[idx].tool_id = 0;
+    }
+}
+
+//for a cached tool the first probe at the fixture starts with a move at the tool change seek rate down to the clearance
+//above the expected toolsetter contact, the probe move then only has to verify the tool length at its own feed.
+//Called when the core has armed the probe: the move is planned ahead of the probe move and runs as part of the probe
+//cycle, so a tool that is now longer than cached is stopped by the toolsetter like in a normal seek.
+static void tool_cache_approach (void)
+{
+    tool_cache_t *entry;
+    float position[N_AXIS], approach;
+    plan_line_data_t plan_data;
+
+    if(!fixture_approach)
+        return;
+
+    fixture_approach = false;
+
+    if(probe_axes.mask != bit(Z_AXIS) || settings.tool_change.seek_rate <= 0.0f || hal.probe.get_state().triggered ||
+        (entry = tool_cache_get(fixture_tool_id)) == NULL)
+        return;
+
+    system_convert_array_steps_to_mpos(position, sys.position);
+    approach = entry->contact + probe_protect_settings.cache_clearance;
+
+    if(position[Z_AXIS] > approach && probe_target[Z_AXIS] < approach) {
+        position[Z_AXIS] = approach;
+        plan_data_init(&plan_data);
+        plan_data.feed_rate = settings.tool_change.seek_rate;
+        mc_line(position, &plan_data);
+    }
+}
+
+static uint8_t crc8 (const void *data, size_t size);
+
+static const char *const probe_source_name[ProbeSource_N] = {
+    "touch",
+    "toolsetter",
+    "toolsetter2",
+    "wireless"
+};
+
+// Adaptive probing feed. The stopping distance after a trigger grows with the square of the feed rate,
+// so the feed is scaled by the square root of the ratio between the target and the measured overtravel.
+// Feed increases are limited per probe and only made when the probe ran at the tuned feed.
+
+static float probe_feed_get (probe_source_t source)
+{
+    float feed = probe_feed.feed[source] == 0.0f ? probe_protect_settings.feed_max : probe_feed.feed[source];
+
+    return min(max(feed, probe_protect_settings.feed_min), probe_protect_settings.feed_max);
+}
+
+static void probe_feed_save (void)
+{
+    if(feed_address) {
+        probe_feed.crc = crc8(&probe_feed, offsetof(probe_feed_data_t, crc));
+        hal.nvs.memcpy_to_nvs(feed_address, (uint8_t *)&probe_feed, sizeof(probe_feed_data_t), false);
+    }
+}
+
+//sets seek moves to the tuned feed for the active source and caps other requested probing feeds to it.
+//Seeks at a lower feed would never reach the tuned feed so tuning could not raise it.
+static void probe_feed_apply (plan_line_data_t *pl_data)
+{
+    float feed;
+
+    probe_feed_used = 0.0f;
+
+    if(probe_protect_settings.overtravel_limit <= 0.0f || pl_data->condition.inverse_time)
+        return;
+
+    feed = probe_feed_get(probe_selected);
+
+    //the toolsetter seek of a tool change is told apart from the locate move by its feed rate.
+    if(probe_feed_seek || (fixture_active && pl_data->feed_rate == settings.tool_change.seek_rate) || pl_data->feed_rate > feed)
+        pl_data->feed_rate = feed;
+
+    probe_feed_used = pl_data->feed_rate;
+}
+
+static void probe_feed_tune (void)
+{
+    float feed, tuned, estimate;
+
+    if(probe_feed_used == 0.0f || !latch.valid)
+        return;
+
+    feed = probe_feed_get(latch.source);
+    estimate = latch.overtravel > 0.0f
+                ? probe_feed_used * sqrtf(probe_protect_settings.overtravel_limit * PROBE_FEED_MARGIN / latch.overtravel)
+                : probe_feed_used * PROBE_FEED_MAX_STEP;
+
+    if(latch.overtravel > probe_protect_settings.overtravel_limit)
+        tuned = min(feed, estimate);
+    else if(probe_feed_used >= feed * (1.0f - PROBE_FEED_HYSTERESIS))
+        tuned = min(estimate, feed * PROBE_FEED_MAX_STEP);
+    else
+        return;
+
+    tuned = min(max(tuned, probe_protect_settings.feed_min), probe_protect_settings.feed_max);
+
+    if(probe_feed.feed[latch.source] == 0.0f || fabsf(tuned - feed) > feed * PROBE_FEED_HYSTERESIS) {
+        probe_feed.feed[latch.source] = tuned;
+        probe_feed_save();
+    }
+}
+
+// Probing acceleration. The planner picks up the axis acceleration when a move is planned and the
+// same value is used for deceleration after a trigger, so raising it for probe moves cuts the overtravel.
+// The planner only reads the axis settings, so the raised values are put there when the core arms the probe
+// and restored on the next pass of the realtime loop, after the probe move has been planned. Nothing else
+// is planned and no setting can be written in between, so the values are never stored or used by other moves.
+
+static void probe_accel_raise (axes_signals_t axes)
+{
+    uint_fast8_t idx;
+
+    if(accel_axes.mask || probe_protect_settings.probe_accel <= 100)
+        return;
+
+    accel_axes.mask = axes.mask & (bit(N_AXIS) - 1);
+
+    for(idx = 0; idx < N_AXIS; idx++) {
+        if(accel_axes.mask & bit(idx)) {
+            saved_accel[idx] = settings.axis[idx].acceleration;
+            settings.axis[idx].acceleration *= (float)probe_protect_settings.probe_accel / 100.0f;
+        }
+    }
+}
+
+static void probe_accel_restore (void)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < N_AXIS; idx++) {
+        if(accel_axes.mask & bit(idx))
+            settings.axis[idx].acceleration = saved_accel[idx];
+    }
+
+    accel_axes.mask = 0;
+}
+
+// Spin-down interlock. A toolsetter probe move is held until the spindle has been off for the spin-down time,
+// and refused if the spindle is still commanded on.
+static bool spindle_spindown_wait (void)
+{
+    if(!(probe_protect_settings.options.spindown_interlock && fixture_active))
+        return true;
+
+    if(spindle_running) {
+        report_message("Probe plugin: spindle running, tool probe aborted", Message_Warning);
+        return false;
+    }
+
+    while((hal.get_elapsed_ticks() - spindle_off_ms) < probe_protect_settings.spindown_time) {
+        if(!protocol_execute_realtime())
+            return false;
+    }
+
+    return true;
+}
+
+static bool probe_start (axes_signals_t axes, float *target, plan_line_data_t *pl_data){
+    //protection is switched off and the trigger latch armed in probeConfigure when the core arms the probe:
+    //on_probe_start is also called for probes that are then not run (check mode, probe already triggered).
+    bool status = true;
+
+    //refused before anything is changed: the core aborts the probe without calling on_probe_completed,
+    //so neither this plugin nor the handlers further down the chain are set up for it.
+    if(!spindle_spindown_wait())
+        return false;
+
+    METRICS_START();
+
+    probe_feed_apply(pl_data);
+    probe_axes = axes;
+    memcpy(probe_target, target, sizeof(probe_target));
+    probe_pending = true;
+
+    METRICS_END(Hook_ProbeStart);
+
+    if(on_probe_start && !(status = on_probe_start(axes, target, pl_data)))
+        probe_pending = false; //refused further down the chain, the probe will not be armed.
+    
+    return status;
+}
+
+static uint8_t crc8 (const void *data, size_t size)
+{
+    uint_fast8_t bit;
+    uint8_t crc = 0xFF;
+    const uint8_t *byte = (const uint8_t *)data;
+
+    while(size--) {
+        crc ^= *byte++;
+        for(bit = 0; bit < 8; bit++)
+            crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+
+    return crc;
+}
+
+// Binary probe record, written when a probe move completes (ahead of the textual [PRB:] report) if enabled:
+//  0xA5 'P' <payload length> <payload> <crc8 of payload>
+//  payload: uint16 sequence, uint8 flags, uint8 number of axes, int32 trigger position per axis in micrometers.
+//  Multibyte values are little endian.
+static void probe_record_write (void)
+{
+    static uint16_t seq = 0;
+    static uint8_t record[3 + PROBE_RECORD_PAYLOAD + 1];
+
+    uint_fast8_t idx;
+    int32_t um;
+    uint8_t *p = &record[3];
+
+    if(hal.stream.write_n == NULL)
+        return;
+
+    record[0] = 0xA5;
+    record[1] = 'P';
+    record[2] = PROBE_RECORD_PAYLOAD;
+
+    *p++ = (uint8_t)seq;
+    *p++ = (uint8_t)(seq >> 8);
+    *p++ = (sys.flags.probe_succeeded ? PROBE_RECORD_SUCCEEDED : 0) |
+            (latch.source == ProbeSource_Toolsetter || latch.source == ProbeSource_Toolsetter2 ? PROBE_RECORD_TOOLSETTER : 0) |
+             (cycle_active ? PROBE_RECORD_CYCLE : 0) | (latch.source << PROBE_RECORD_SOURCE_SHIFT);
+    *p++ = N_AXIS;
+
+    for(idx = 0; idx < N_AXIS; idx++) {
+        um = (int32_t)lroundf((float)sys.probe_position[idx] * 1000.0f / settings.axis[idx].steps_per_mm);
+        *p++ = (uint8_t)um;
+        *p++ = (uint8_t)(um >> 8);
+        *p++ = (uint8_t)(um >> 16);
+        *p++ = (uint8_t)(um >> 24);
+    }
+
+    *p = crc8(&record[3], PROBE_RECORD_PAYLOAD);
+
+    hal.stream.write_n(record, sizeof(record));
+
+    seq++;
+}
+
+static void probe_completed (void){
+    METRICS_START();
+
+    probing = false;
+    zone_start_valid = false; //the planner is synced to where the probe stopped.
+    latch_complete();
+    probe_feed_tune();
+
+    if(probe_protect_settings.options.binary_report)
+        probe_record_write();
+
+    //re-activate protection, unless a probing cycle run by the plugin continues with more moves.
+    if(!cycle_active)
+        protection_on();
+
+    METRICS_END(Hook_ProbeCompleted);
+
+    if(on_probe_completed)
+        on_probe_completed();
+}
+
+static inline bool tlr_reference_valid (void)
+{
+    return tlr.reference.crc == crc8(&tlr.reference, offsetof(tlr_reference_t, crc));
+}
+
+static inline bool tlr_tool_valid (tlr_tool_t *entry)
+{
+    return entry->tool_id && entry->crc == crc8(entry, offsetof(tlr_tool_t, crc));
+}
+
+//returns the stored entry for the tool, NULL if none.
+static tlr_tool_t *tlr_tool_get (uint32_t tool_id)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < PROBE_TLR_TOOLS; idx++) {
+        if(tlr.tool[idx].tool_id == tool_id && tlr_tool_valid(&tlr.tool[idx]))
+            return &tlr.tool[idx];
+    }
+
+    return NULL;
+}
+
+//writes changed reference and tool offset values to NVS.
+static void tlr_update (tool_data_t *tool)
+{
+    uint_fast8_t idx;
+    tlr_tool_t *entry;
+
+    if(!(tlr_address && probe_protect_settings.options.persist_tlr))
+        return;
+
+    if(sys.tlo_reference_set.z && !(tlr_reference_valid() && tlr.reference.reference == sys.tlo_reference[Z_AXIS])) {
+        tlr.reference.reference = sys.tlo_reference[Z_AXIS];
+        tlr.reference.crc = crc8(&tlr.reference, offsetof(tlr_reference_t, crc));
+        hal.nvs.memcpy_to_nvs(tlr_address + offsetof(tlr_data_t, reference), (uint8_t *)&tlr.reference, sizeof(tlr_reference_t), false);
+    }
+
+    if(tool == NULL || tool->tool_id == 0)
+        return;
+
+    if((entry = tlr_tool_get(tool->tool_id)) == NULL) {
+        //use a free slot if available, else replace round robin.
+        for(idx = 0; idx < PROBE_TLR_TOOLS && tlr_tool_valid(&tlr.tool[idx]); idx++);
+        if(idx == PROBE_TLR_TOOLS) {
+            idx = tlr_next;
+            tlr_next = (tlr_next + 1) % PROBE_TLR_TOOLS;
+        }
+        entry = &tlr.tool[idx];
+    } else if(entry->offset == gc_state.tool_length_offset[Z_AXIS])
+        return;
+
+    entry->tool_id = tool->tool_id;
+    entry->offset = gc_state.tool_length_offset[Z_AXIS];
+    entry->crc = crc8(entry, offsetof(tlr_tool_t, crc));
+    hal.nvs.memcpy_to_nvs(tlr_address + offsetof(tlr_data_t, tool) + (entry - tlr.tool) * sizeof(tlr_tool_t), (uint8_t *)entry, sizeof(tlr_tool_t), false);
+}
+
+//restores the tool length reference so the first tool change does not have to probe it again.
+//Run as a foreground task as the core clears the system state after the plugins are initialized.
+static void tlr_restore (void *data)
+{
+    if(tlr_address && probe_protect_settings.options.persist_tlr && !sys.tlo_reference_set.z && tlr_reference_valid()) {
+        sys.tlo_reference[Z_AXIS] = tlr.reference.reference;
+        sys.tlo_reference_set.z = On;
+        report_message("Probe plugin: tool length reference restored", Message_Info);
+    }
+}
+
+//seeds the tool length cache from the stored tool offsets on startup, the toolsetter contact is the reference
+//plus the offset. The tools may have been changed while the machine was off, so the entries are seeded as expired:
+//the first change to a stored tool is measured in full and warns if the length differs from the stored one.
+//Run after tlr_restore.
+static void tlr_seed_cache (void *data)
+{
+    uint_fast8_t idx;
+    tlr_tool_t *stored;
+    tool_cache_t *entry;
+
+    if(!(tlr_address && probe_protect_settings.options.persist_tlr && probe_protect_settings.options.tool_cache &&
+          tlr_reference_valid() && sys.tlo_reference_set.z && sys.tlo_reference[Z_AXIS] == tlr.reference.reference))
+        return;
+
+    for(idx = 0; idx < PROBE_TLR_TOOLS; idx++) {
+        stored = &tlr.tool[idx];
+        if(tlr_tool_valid(stored) && (entry = tool_cache_slot(stored->tool_id))->tool_id != stored->tool_id) {
+            tool_cache_set(entry, stored->tool_id, (float)tlr.reference.reference / settings.axis[Z_AXIS].steps_per_mm + stored->offset);
+            entry->expired = true;
+        }
+    }
+}
+
+static void tool_changed (tool_data_t *tool){    
+    //tool_change.c sets grbl.on_probe_completed to NULL when finished.  Is this correct?  That breaks the call chain in this plugin.
+    //restore the pointer here.
+    
+    if(grbl.on_probe_completed == NULL){
+        on_probe_completed = grbl.on_probe_completed;
+        grbl.on_probe_completed = probe_completed;
+    }
+
+    tlr_update(tool);
+
+    //continue call chain
+    if(on_tool_changed)
+        on_tool_changed(tool);
+} 
+
+//sets up probing at the fixture, variant per invert.
+#define FIXTURE_ON_VARIANT(name, invert) \
+static void name (probe_source_t source) \
+{ \
+    /* set polarity before probing the fixture. */ \
+    if(invert) \
+        settings.probe.invert_probe_pin = !nvs_invert_probe_pin; \
+\
+    /* if a different pin is configured, route probe reading to that pin. */ \
+    if(probe_source[source].aux) \
+        report_message("Activating alternate tool pin", Message_Info); \
+    probe_select(source); \
+}
+
+//restores the probe input after probing at the fixture, variant per invert.
+#define FIXTURE_OFF_VARIANT(name, invert) \
+static void name (void) \
+{ \
+    if(probe_source[probe_selected].aux && probe_selected != probe_base) \
+        report_message("Restoring probe pin", Message_Info); \
+    probe_select(probe_base); \
+    if(invert) \
+        settings.probe.invert_probe_pin = nvs_invert_probe_pin; /* restore pin inversion setting */ \
+}
+
+FIXTURE_ON_VARIANT(fixture_on, 0)
+FIXTURE_ON_VARIANT(fixture_on_invert, 1)
+FIXTURE_OFF_VARIANT(fixture_off, 0)
+FIXTURE_OFF_VARIANT(fixture_off_invert, 1)
+
+// [invert]
+static void (*const fixture_on_variant[2])(probe_source_t source) = { fixture_on, fixture_on_invert };
+static void (*const fixture_off_variant[2])(void) = { fixture_off, fixture_off_invert };
+
+static void (*fixture_setup)(probe_source_t source) = fixture_on;
+static void (*fixture_restore)(void) = fixture_off;
+
+//The grbl.on_probe_fixture event handler is called by the default tool change algorithm when probing at G59.3.
+//In addition it will be called on a "normal" probe sequence if the XY position is
 //within the radius of the G59.3 position defined below.
 // When called from "normal" probing tool is always NULL, when called from within
 // a tool change sequence (M6) then tool is a pointer to the selected tool.
 bool probe_fixture (tool_data_t *tool, coord_data_t *position, bool at_g59_3, bool on)
 {
+    METRICS_START();
+
     bool status = true;
 
-    if(at_g59_3 && on){ //are doing a tool change.
-        
-        report_message("Doing tool probe", Message_Info);
+    if(at_g59_3 && on){ //are doing a tool change.
+        
+        report_message("Doing tool probe", Message_Info);
+
+        protection_off();  //disable protection when probing
+
+        fixture_tool_id = tool ? tool->tool_id : 0;
+
+        fixture_setup(probe_fixture_source(tool ? tool->tool_id : (current_tool ? current_tool->tool_id : 0)));
+
+        fixture_approach = fixture_active = true;
+
+        //set hard limits before probing the fixture.
+        //if(!nvs_hardlimits && probe_protect_settings.flags.hardlimits){ //if the hard limits are not already enabled they need to be enabled.
+        //    hal.limits.enable(settings.limits.flags.hard_enabled, true); // Change immediately. NOTE: Nice to have but could be problematic later.
+        //}
+    }else{
+        if(fixture_tool_id) {
+            tool_cache_store(fixture_tool_id);
+            fixture_tool_id = 0;
+        }
+        fixture_approach = fixture_active = false;
+        fixture_restore();
+        //hal.limits.enable(settings.limits.flags.hard_enabled, nvs_hardlimits);  //restore hard limit settings.
+        protection_on();      //restore protection.  
+    }
+
+    METRICS_END(Hook_ProbeFixture);
+    
+    //typedef bool (*on_probe_toolsetter_ptr)(tool_data_t *tool, coord_data_t *position, bool at_g59_3, bool on)
+    if(on_probe_fixture)
+        status = on_probe_fixture(tool, position, at_g59_3, on);
+
+    return status;
+}
+
+//static void on_probe_connected_toggle(void){
+//splits a macro setting into lines, done when the settings are loaded or saved so the macro can start without parsing.
+static void macro_compile (probe_macro_t *macro, const char *src)
+{
+    char *s = macro->text;
+
+    strcpy(macro->text, src);
+    macro->lines = 0;
+
+    while(*s && macro->lines < PROBE_MACRO_LINES) {
+
+        while(*s == ' ')
+            s++;
+
+        if(*s && *s != '|')
+            macro->line[macro->lines++] = s;
+
+        if((s = strchr(s, '|')) == NULL)
+            break;
+
+        *s++ = '\0';
+    }
+}
+
+static void macro_start (probe_macro_t *macro)
+{
+    macro_running = macro->lines ? macro : NULL;
+    macro_line = 0;
+}
+
+//submits the next macro line when the controller accepts it, called from the realtime loop.
+static void macro_poll (void)
+{
+    if(macro_running && grbl.enqueue_gcode(macro_running->line[macro_line])) {
+        if(++macro_line == macro_running->lines)
+            macro_running = NULL;
+    }
+}
+
+//the controller may be running a job if it is not idle, a file is run or the sender has lines queued in the input buffer.
+static bool macro_can_start (void)
+{
+    return state_get() == STATE_IDLE && !gc_state.file_run && !(hal.stream.get_rx_buffer_count && hal.stream.get_rx_buffer_count());
+}
+
+static void set_connected_status(void *data){    
+    
+    static uint8_t previous_flags;
+    //probe_state_t probe = hal.probe.get_state();
+
+    check_connected_pin();
+    
+    if(probe_connected.value){
+        protection_on(); 
+    } else{
+        protection_off(); 
+    }
+
+    //the report is deferred to the foreground so changes can be coalesced.
+    if (previous_flags != probe_connected.value) {
+        trace_add(Event_ConnectChange, probe_connected.value);
+        connected_report_pending = true;
+        //macros are only run for changes of the external connected pin (or heartbeat), M401/M402, T99 and the
+        //toggle come from the program or the sender. Dropped if a job may be running, the lines would be injected into it.
+        if(!previous_flags != !probe_connected.value && ((probe_connected_flags_t){ .value = previous_flags ^ probe_connected.value }).ext_pin) {
+            if(macro_can_start())
+                macro_start(probe_connected.value ? &connect_macro : &disconnect_macro);
+            else if((probe_connected.value ? &connect_macro : &disconnect_macro)->lines)
+                report_message("Probe plugin: controller busy, probe connect macro not run", Message_Warning);
+        }
+    }
+
+    previous_flags = probe_connected.value;   
+}
+
+//appends the letters of the active connected sources: E - external pin, T - T99, M - M401, C - connect toggle.
+static char *connected_sources (char *buf)
+{
+    if(probe_connected.ext_pin)
+        *buf++ = 'E';
+    if(probe_connected.t99)
+        *buf++ = 'T';
+    if(probe_connected.mcode)
+        *buf++ = 'M';
+    if(probe_connected.toggle)
+        *buf++ = 'C';
+    *buf = '\0';
+
+    return buf;
+}
+
+//outputs a single message for the current connected state, no more often than the configured interval.
+static void report_connected (void)
+{
+    static char msg[24];
+    uint32_t ms = hal.get_elapsed_ticks();
+
+    if(!connected_report_pending || (ms - connected_report_ms) < probe_protect_settings.report_interval)
+        return;
+
+    connected_report_pending = false;
+
+    if(connected_reported == probe_connected.value) //changed back within the interval.
+        return;
+
+    connected_reported = probe_connected.value;
+    connected_report_ms = ms;
+
+    if(probe_connected.value) {
+        strcpy(msg, "Probe connected:");
+        connected_sources(strchr(msg, '\0'));
+        report_message(msg, Message_Info);
+    } else
+        report_message("Probe disconnected, protection off.", Message_Info);
+}
+
+static void onRealtimeReport (stream_write_ptr stream_write, report_tracking_flags_t report)
+{
+    char buf[10];
+
+    if(probe_protect_settings.options.rt_report && probe_connected.value) {
+        strcpy(buf, "|PRC:");
+        connected_sources(strchr(buf, '\0'));
+        stream_write(buf);
+    }
+
+    if(on_realtime_report)
+        on_realtime_report(stream_write, report);
+}
+
+static void onSpindleSetState (spindle_ptrs_t *spindle, spindle_state_t state, float rpm)
+{
+    METRICS_START();
+
+    //If the probe is connected and the spindle is turning on, alarm.
+    if(probe_connected.value && (state.value !=0)){
+        state.value = 0; //ensure spindle is off
+        grbl.enqueue_realtime_command(CMD_STOP);
+        trace_add(Event_SpindleBlocked, 0);
+        trace_add(Event_CmdStop, Stop_ProbeInSpindle);
+    }
+
+    //track spindle run time for the tool length cache.
+    if(state.on != spindle_running) {
+        if((spindle_running = state.on))
+            spindle_on_ms = hal.get_elapsed_ticks();
+        else {
+            spindle_off_ms = hal.get_elapsed_ticks();
+            spindle_total_ms += spindle_off_ms - spindle_on_ms;
+        }
+    }
+
+    METRICS_END(Hook_SpindleSetState);
+
+    on_spindle_set_state(spindle, state, rpm);
+}
+
+static bool onSpindleSelect (spindle_ptrs_t *spindle)
+{   
+    on_spindle_set_state = spindle->set_state;
+    spindle->set_state = onSpindleSetState;
+
+    return on_spindle_select == NULL || on_spindle_select(spindle);
+}
+
+static void onToolSelected (tool_data_t *tool)
+{
+    //probe_state_t probe = hal.probe.get_state();
+    //if the tool is 99, set probe connected.
+    METRICS_START();
+
+    current_tool = tool;
+
+    if ((tool->tool_id == 99) && probe_protect_settings.flags.t99_protect){
+        probe_connected.t99 = true;     
+    }else {
+        probe_connected.t99 = false;        
+    }
+
+    set_connected_status(&tool->tool_id);
+
+    if(!probe_manual)
+        probe_base = probe_tool_source(tool->tool_id);
+
+    if(!fixture_active)
+        probe_select(probe_base);
+
+    METRICS_END(Hook_ToolSelected);
+
+    if(on_tool_selected)
+        on_tool_selected(tool);
+}
+
+// Probing cycles executed by the plugin, protection stays suspended until the cycle ends
+// as the probe may still be deflected when moving away from a touch.
+
+static void cycle_begin (void)
+{
+    cycle_active = true;
+    protection_off();
+}
+
+static void cycle_end (void)
+{
+    cycle_active = false;
+    zone_start_valid = false;
+    system_convert_array_steps_to_mpos(gc_state.position, sys.position); //sync parser position.
+    protection_on();
+}
+
+//feed move, a feed rate of 0 is a rapid move.
+static bool cycle_move (float *target, float feed_rate)
+{
+    plan_line_data_t plan_data;
+
+    plan_data_init(&plan_data);
+    plan_data.feed_rate = feed_rate;
+    plan_data.condition.rapid_motion = feed_rate == 0.0f;
+
+    return mc_line(target, &plan_data) && protocol_buffer_synchronize();
+}
+
+//single probe move toward target, returns the (latched) trigger step position.
+static bool cycle_probe (float *target, float feed_rate, int32_t *trigger)
+{
+    plan_line_data_t plan_data;
+    gc_parser_flags_t flags = {0};
+
+    plan_data_init(&plan_data);
+    plan_data.feed_rate = feed_rate;
+
+    if(mc_probe_cycle(target, &plan_data, flags) != GCProbe_Found)
+        return false;
+
+    memcpy(trigger, sys.probe_position, sizeof(sys.probe_position));
+
+    return true;
+}
+
+//seek move of a plugin cycle, runs at the tuned feed when the adaptive feed is enabled.
+static bool cycle_seek (float *target, float feed_rate, int32_t *trigger)
+{
+    bool ok;
+
+    probe_feed_seek = true;
+    ok = cycle_probe(target, feed_rate, trigger);
+    probe_feed_seek = false;
+
+    return ok;
+}
+
+//offsets position along the unit vector dir.
+static void cycle_offset (float *target, const float *position, const float *dir, float distance)
+{
+    uint_fast8_t idx = N_AXIS;
+
+    do {
+        idx--;
+        target[idx] = position[idx] + dir[idx] * distance;
+    } while(idx);
+}
+
+// Seek up to distance along the unit vector dir at the fast feed, back off and probe at the slow feed
+// cycle->repeats times. Returns the mean trigger step position, the machine is left backed off from the surface.
+static bool cycle_probe_point (probe_cycle_t *cycle, const float *dir, float distance, int32_t *result)
+{
+    uint_fast8_t idx, repeat;
+    int32_t trigger[N_AXIS];
+    int64_t sum[N_AXIS] = {0};
+    float position[N_AXIS], target[N_AXIS];
+
+    system_convert_array_steps_to_mpos(position, sys.position);
+    cycle_offset(target, position, dir, distance);
+
+    if(!cycle_seek(target, cycle->fast_feed, trigger))
+        return false;
+
+    for(repeat = 0; repeat < cycle->repeats; repeat++) {
+
+        system_convert_array_steps_to_mpos(position, trigger);
+        cycle_offset(target, position, dir, -cycle->retract);
+
+        if(!cycle_move(target, cycle->fast_feed))
+            return false;
+
+        cycle_offset(target, position, dir, cycle->retract);
+
+        if(!cycle_probe(target, cycle->slow_feed, trigger))
+            return false;
+
+        for(idx = 0; idx < N_AXIS; idx++)
+            sum[idx] += trigger[idx];
+    }
+
+    for(idx = 0; idx < N_AXIS; idx++)
+        result[idx] = (int32_t)(sum[idx] / cycle->repeats);
+
+    system_convert_array_steps_to_mpos(position, trigger);
+    cycle_offset(target, position, dir, -cycle->retract);
+
+    return cycle_move(target, cycle->fast_feed);
+}
+
+//converts the I/J/K words to a unit vector, returns its length.
+static float cycle_direction (parser_block_t *gc_block, float *dir)
+{
+    uint_fast8_t idx;
+    float length = 0.0f;
+
+    memset(dir, 0, sizeof(float) * N_AXIS);
+
+    for(idx = 0; idx < 3; idx++) {
+        dir[idx] = gc_block->values.ijk[idx];
+        length += dir[idx] * dir[idx];
+    }
+
+    if((length = sqrtf(length)) > 0.0f) {
+        for(idx = 0; idx < 3; idx++)
+            dir[idx] /= length;
+    }
+
+    return length;
+}
+
+// M403 - two stage probe.
+static void probe_two_stage (parser_block_t *gc_block)
+{
+    float dir[N_AXIS], distance;
+    int32_t result[N_AXIS];
+    probe_cycle_t cycle = {
+        .fast_feed = gc_block->values.p,
+        .slow_feed = gc_block->values.q > 0.0f ? gc_block->values.q : gc_block->values.p / 10.0f,
+        .retract = gc_block->values.r > 0.0f ? gc_block->values.r : PROBE_CYCLE_RETRACT,
+        .repeats = gc_block->values.l >= 1 ? (uint_fast8_t)gc_block->values.l : 1
+    };
+
+    if((distance = cycle_direction(gc_block, dir)) == 0.0f)
+        return;
+
+    cycle_begin();
+
+    if(cycle_probe_point(&cycle, dir, distance, result)) {
+        memcpy(sys.probe_position, result, sizeof(sys.probe_position));
+        sys.flags.probe_succeeded = On;
+        report_probe_parameters();
+    }
+
+    cycle_end();
+}
+
+static void stats_add (probe_stats_t *stats, const int32_t *steps)
+{
+    uint_fast8_t idx;
+    float value, delta;
+
+    stats->n++;
+
+    for(idx = 0; idx < N_AXIS; idx++) {
+
+        value = (float)steps[idx] / settings.axis[idx].steps_per_mm;
+
+        if(stats->n == 1) {
+            stats->base[idx] = value;
+            stats->mean[idx] = stats->m2[idx] = 0.0f;
+            stats->min[idx] = stats->max[idx] = value;
+        } else {
+            stats->min[idx] = min(stats->min[idx], value);
+            stats->max[idx] = max(stats->max[idx], value);
+        }
+
+        value -= stats->base[idx];
+        delta = value - stats->mean[idx];
+        stats->mean[idx] += delta / (float)stats->n;
+        stats->m2[idx] += delta * (value - stats->mean[idx]);
+    }
+}
+
+static void stats_write (const char *label, const float *values, uint8_t decimals)
+{
+    uint_fast8_t idx;
+
+    hal.stream.write(label);
+
+    for(idx = 0; idx < N_AXIS; idx++) {
+        if(idx)
+            hal.stream.write(",");
+        hal.stream.write(ftoa(values[idx], decimals));
+    }
+}
+
+static void stats_report (probe_stats_t *stats)
+{
+    uint_fast8_t idx;
+    float values[N_AXIS];
+
+    hal.stream.write("[RPT:");
+    hal.stream.write(uitoa(stats->n));
+
+    for(idx = 0; idx < N_AXIS; idx++)
+        values[idx] = stats->base[idx] + stats->mean[idx];
+    stats_write("|MEAN:", values, 4);
+
+    for(idx = 0; idx < N_AXIS; idx++)
+        values[idx] = stats->n > 1 ? sqrtf(stats->m2[idx] / (float)(stats->n - 1)) : 0.0f;
+    stats_write("|SD:", values, 4);
+
+    stats_write("|MIN:", stats->min, 4);
+    stats_write("|MAX:", stats->max, 4);
+
+    for(idx = 0; idx < N_AXIS; idx++)
+        values[idx] = stats->max[idx] - stats->min[idx];
+    stats_write("|RANGE:", values, 4);
+
+    hal.stream.write("]" ASCII_EOL);
+}
+
+// M406 - repeatability test. Only the summary is reported, positions are machine coordinates.
+static void probe_repeatability (parser_block_t *gc_block)
+{
+    uint_fast8_t repeat;
+    int32_t trigger[N_AXIS];
+    float dir[N_AXIS], distance, position[N_AXIS], target[N_AXIS];
+    float retract = gc_block->values.r > 0.0f ? gc_block->values.r : PROBE_CYCLE_RETRACT;
+    probe_stats_t stats = {0};
+    bool ok;
+
+    if((distance = cycle_direction(gc_block, dir)) == 0.0f)
+        return;
+
+    cycle_begin();
+
+    system_convert_array_steps_to_mpos(position, sys.position);
+    cycle_offset(target, position, dir, distance);
+
+    ok = cycle_probe(target, gc_block->values.p, trigger);
+
+    for(repeat = 0; ok && repeat < (uint_fast8_t)gc_block->values.l; repeat++) {
+
+        system_convert_array_steps_to_mpos(position, trigger);
+        cycle_offset(target, position, dir, -retract);
+
+        if((ok = cycle_move(target, gc_block->values.p))) {
+            cycle_offset(target, position, dir, retract);
+            if((ok = cycle_probe(target, gc_block->values.p, trigger)))
+                stats_add(&stats, trigger);
+        }
+    }
+
+    if(ok) {
+        system_convert_array_steps_to_mpos(position, trigger);
+        cycle_offset(target, position, dir, -retract);
+        cycle_move(target, gc_block->values.p);
+    }
+
+    cycle_end();
+
+    if(stats.n)
+        stats_report(&stats);
+
+    if(!ok)
+        report_message("Probe plugin: repeatability test aborted", Message_Warning);
+}
+
+// Feature probing cycles. Positioning moves toward the stock are run as probe moves that are not
+// expected to touch, a trigger aborts the cycle instead of ramming the probe into the part.
+
+static bool cycle_guarded_move (float *target, float feed_rate)
+{
+    plan_line_data_t plan_data;
+    gc_parser_flags_t flags = {0};
+
+    plan_data_init(&plan_data);
+    plan_data.feed_rate = feed_rate;
+    flags.probe_is_no_error = On;
+
+    return mc_probe_cycle(target, &plan_data, flags) == GCProbe_FailEnd;
+}
+
+//two stage touch along dir from the current position, returns the trigger position in mm.
+static bool cycle_touch (probe_cycle_t *cycle, const float *dir, float distance, float *touch)
+{
+    int32_t result[N_AXIS];
+
+    if(!cycle_probe_point(cycle, dir, distance, result))
+        return false;
+
+    system_convert_array_steps_to_mpos(touch, result);
+
+    return true;
+}
+
+// Finds the center along one axis by touching both sides, outward from the center for a bore,
+// inward from radius outside the center and depth below it for a boss. Ends at the center.
+static bool cycle_center_axis (probe_cycle_t *cycle, float *center, uint_fast8_t axis, float radius, float depth, float *span)
+{
+    uint_fast8_t side;
+    float dir[N_AXIS] = {0}, target[N_AXIS], touch[2][N_AXIS];
+
+    for(side = 0; side < 2; side++) {
+
+        dir[axis] = side ? -1.0f : 1.0f;
+
+        if(depth > 0.0f) {
+            memcpy(target, center, sizeof(target));
+            target[axis] += dir[axis] * radius;
+            if(!cycle_guarded_move(target, cycle->fast_feed))
+                return false;
+            target[Z_AXIS] -= depth;
+            if(!cycle_guarded_move(target, cycle->fast_feed))
+                return false;
+            dir[axis] = -dir[axis];
+        }
+
+        if(!cycle_touch(cycle, dir, radius, touch[side]))
+            return false;
+
+        if(depth > 0.0f) { //back up above the boss.
+            system_convert_array_steps_to_mpos(target, sys.position);
+            target[Z_AXIS] = center[Z_AXIS];
+            if(!cycle_move(target, cycle->fast_feed))
+                return false;
+        }
+
+        if(!cycle_move(center, cycle->fast_feed))
+            return false;
+    }
+
+    center[axis] = (touch[0][axis] + touch[1][axis]) / 2.0f;
+    *span = fabsf(touch[0][axis] - touch[1][axis]);
+
+    return cycle_move(center, cycle->fast_feed);
+}
+
+// Touches the X face and then the Y face of a corner. For an outside corner the X face is probed
+// after moving dy along Y and the Y face after moving dx along X, the machine returns to the start in between.
+static bool cycle_corner (probe_cycle_t *cycle, float dx, float dy, bool outside, float *corner)
+{
+    uint_fast8_t axis;
+    float start[N_AXIS], target[N_AXIS], dir[N_AXIS], touch[N_AXIS];
+    float distance[2] = { dx, dy };
+
+    system_convert_array_steps_to_mpos(start, sys.position);
+    memcpy(corner, start, sizeof(start));
+
+    for(axis = X_AXIS; axis <= Y_AXIS; axis++) {
+
+        memcpy(target, start, sizeof(target));
+
+        if(outside) {
+            target[axis == X_AXIS ? Y_AXIS : X_AXIS] += distance[axis == X_AXIS ? Y_AXIS : X_AXIS];
+            if(!cycle_guarded_move(target, cycle->fast_feed))
+                return false;
+        }
+
+        memset(dir, 0, sizeof(dir));
+        dir[axis] = distance[axis] > 0.0f ? 1.0f : -1.0f;
+
+        if(!cycle_touch(cycle, dir, fabsf(distance[axis]), touch))
+            return false;
+
+        corner[axis] = touch[axis] + dir[axis] * probe_protect_settings.tip_diameter / 2.0f;
+
+        if(!(cycle_move(target, cycle->fast_feed) && cycle_move(start, cycle->fast_feed)))
+            return false;
+    }
+
+    return true;
+}
+
+//writes the result to a work offset so it becomes the origin of the given axes.
+static void cycle_set_origin (uint_fast8_t wcs, const float *position, uint8_t axes)
+{
+    uint_fast8_t idx;
+    float offset[N_AXIS];
+    coord_system_id_t id = (coord_system_id_t)(CoordinateSystem_G54 + wcs - 1);
+
+    if(!settings_read_coord_data(id, &offset))
+        return;
+
+    for(idx = 0; idx < N_AXIS; idx++) {
+        if(axes & bit(idx))
+            offset[idx] = position[idx] - gc_state.g92_coord_offset[idx] - gc_state.tool_length_offset[idx];
+    }
+
+    settings_write_coord_data(id, &offset);
+
+    if(gc_state.modal.coord_system.id == id) {
+        memcpy(gc_state.modal.coord_system.xyz, offset, sizeof(offset));
+        system_flag_wco_change();
+    }
+}
+
+static void cycle_report (const char *name, const float *position, uint8_t axes, float diameter)
+{
+    static const char axis_letter[] = "XYZ";
+
+    uint_fast8_t idx;
+    bool first = true;
+
+    hal.stream.write("[");
+    hal.stream.write(name);
+    hal.stream.write(":");
+
+    for(idx = X_AXIS; idx <= Z_AXIS; idx++) {
+        if(axes & bit(idx)) {
+            char letter[2] = { axis_letter[idx], '\0' };
+            if(!first)
+                hal.stream.write(",");
+            hal.stream.write(letter);
+            hal.stream.write(ftoa(position[idx] - gc_state.modal.coord_system.xyz[idx] - gc_state.g92_coord_offset[idx] - gc_state.tool_length_offset[idx], 3));
+            first = false;
+        }
+    }
+
+    if(diameter > 0.0f) {
+        hal.stream.write(",D");
+        hal.stream.write(ftoa(diameter, 3));
+    }
+
+    hal.stream.write("]" ASCII_EOL);
+}
+
+// M408 - bore, boss, edge and corner probing cycles.
+static void probe_feature (parser_block_t *gc_block)
+{
+    static const char *const cycle_name[ProbeCycle_N] = { "BORE", "BOSS", "EDGE", "CORNER", "CORNER" };
+
+    uint_fast8_t idx;
+    uint8_t axes = bit(X_AXIS)|bit(Y_AXIS);
+    float result[N_AXIS], dir[N_AXIS], span_x, span_y, distance, diameter = 0.0f;
+    probe_cycle_type_t type = (probe_cycle_type_t)gc_block->values.p;
+    probe_cycle_t cycle = {
+        .fast_feed = gc_block->values.f,
+        .slow_feed = gc_block->values.f / 10.0f,
+        .retract = gc_block->values.r > 0.0f ? gc_block->values.r : PROBE_CYCLE_RETRACT,
+        .repeats = 1
+    };
+    bool ok;
+
+    cycle_begin();
+
+    system_convert_array_steps_to_mpos(result, sys.position);
+
+    switch(type) {
+
+        case ProbeCycle_Bore:
+        case ProbeCycle_Boss:
+            distance = type == ProbeCycle_Boss ? gc_block->values.ijk[Z_AXIS] : 0.0f;
+            if((ok = cycle_center_axis(&cycle, result, X_AXIS, gc_block->values.ijk[X_AXIS], distance, &span_x) &&
+                      cycle_center_axis(&cycle, result, Y_AXIS, gc_block->values.ijk[Y_AXIS] > 0.0f ? gc_block->values.ijk[Y_AXIS] : gc_block->values.ijk[X_AXIS], distance, &span_y))) {
+                diameter = (span_x + span_y) / 2.0f;
+                diameter += type == ProbeCycle_Bore ? probe_protect_settings.tip_diameter : -probe_protect_settings.tip_diameter;
+            }
+            break;
+
+        case ProbeCycle_Edge:
+            distance = cycle_direction(gc_block, dir);
+            if((ok = cycle_touch(&cycle, dir, distance, result))) {
+                axes = 0;
+                for(idx = X_AXIS; idx <= Z_AXIS; idx++) {
+                    if(dir[idx] != 0.0f) {
+                        axes |= bit(idx);
+                        if(idx != Z_AXIS)
+                            result[idx] += dir[idx] * probe_protect_settings.tip_diameter / 2.0f;
+                    }
+                }
+            }
+            break;
+
+        default:
+            ok = cycle_corner(&cycle, gc_block->values.ijk[X_AXIS], gc_block->values.ijk[Y_AXIS], type == ProbeCycle_OutsideCorner, result);
+            break;
+    }
+
+    cycle_end();
+
+    if(ok) {
+        if(gc_block->values.q >= 1.0f)
+            cycle_set_origin((uint_fast8_t)gc_block->values.q, result, axes);
+        cycle_report(cycle_name[type], result, axes, diameter);
+    } else
+        report_message("Probe plugin: probing cycle aborted", Message_Warning);
+}
+
+// Scanning. The probe state is sampled on every step while the scan move runs, this replaces the
+// protection step hook which is off for the duration of the cycle.
+
+ISR_CODE static void scan_sample (bool deflected, bool edge)
+{
+    uint32_t head = scan.head;
+    scan_sample_t *sample;
+
+    if(head - __atomic_load_n(&scan.tail, __ATOMIC_ACQUIRE) >= PROBE_SCAN_SIZE) {
+        scan.overruns++;
+        return;
+    }
+
+    sample = &scan.sample[head & (PROBE_SCAN_SIZE - 1)];
+    memcpy(sample->position, (void *)sys.position, sizeof(sample->position));
+    sample->flags = (deflected ? SCAN_DEFLECTED : 0) | (edge ? SCAN_EDGE : 0);
+
+    scan.last_position = sys.position[scan.axis];
+    scan.last_ms = hal.get_elapsed_ticks();
+
+    __atomic_store_n(&scan.head, head + 1, __ATOMIC_RELEASE);
+}
+
+ISR_CODE static void on_scan_pulse_start (stepper_t *stepper)
+{
+    bool deflected = hal.probe.get_state().triggered;
+
+    if(deflected != scan.deflected) {
+        scan.deflected = deflected;
+        scan_sample(deflected, true);
+    } else if(deflected && ((scan.interval_steps && labs(sys.position[scan.axis] - scan.last_position) >= scan.interval_steps) ||
+                             (scan.interval_ms && hal.get_elapsed_ticks() - scan.last_ms >= scan.interval_ms)))
+        scan_sample(true, false);
+
+    if(scan_pulse_start)
+        scan_pulse_start(stepper);
+}
+
+static void scan_stop (void)
+{
+    if(scan.active) {
+        scan.active = false;
+        hal.stepper.pulse_start = scan_pulse_start;
+        scan_pulse_start = NULL;
+    }
+}
+
+//streams complete batches, all pending samples if flush is set.
+static void scan_drain (bool flush)
+{
+    uint_fast8_t idx, count;
+    uint32_t head = __atomic_load_n(&scan.head, __ATOMIC_ACQUIRE);
+    scan_sample_t *sample;
+    float position[N_AXIS];
+
+    while(head - scan.tail >= PROBE_SCAN_BATCH || (flush && head != scan.tail)) {
+
+        hal.stream.write("[SCAN:");
+
+        for(count = 0; count < PROBE_SCAN_BATCH && scan.tail != head; count++) {
+
+            sample = &scan.sample[scan.tail & (PROBE_SCAN_SIZE - 1)];
+            system_convert_array_steps_to_mpos(position, sample->position);
+
+            if(count)
+                hal.stream.write(";");
+
+            for(idx = 0; idx < N_AXIS; idx++) {
+                hal.stream.write(ftoa(position[idx], 3));
+                hal.stream.write(",");
+            }
+            hal.stream.write(uitoa(sample->flags));
+
+            __atomic_store_n(&scan.tail, scan.tail + 1, __ATOMIC_RELEASE);
+        }
+
+        hal.stream.write("]" ASCII_EOL);
+    }
+}
+
+// M409 - scan along a vector. Positions are machine coordinates.
+static void probe_scan (parser_block_t *gc_block)
+{
+    uint_fast8_t idx;
+    float dir[N_AXIS], position[N_AXIS], target[N_AXIS], distance;
+
+    distance = cycle_direction(gc_block, dir);
+
+    scan.axis = X_AXIS;
+    for(idx = Y_AXIS; idx <= Z_AXIS; idx++) {
+        if(fabsf(dir[idx]) > fabsf(dir[scan.axis]))
+            scan.axis = idx;
+    }
+
+    scan.interval_steps = gc_block->values.p > 0.0f
+                           ? max(1, (int32_t)lroundf(gc_block->values.p * fabsf(dir[scan.axis]) * settings.axis[scan.axis].steps_per_mm))
+                           : 0;
+    scan.interval_ms = (uint32_t)gc_block->values.q;
+    scan.head = scan.tail = scan.overruns = 0;
+    scan.last_position = sys.position[scan.axis];
+    scan.last_ms = hal.get_elapsed_ticks();
+
+    system_convert_array_steps_to_mpos(position, sys.position);
+    cycle_offset(target, position, dir, distance);
+
+    cycle_begin();
+
+    if((scan.deflected = hal.probe.get_state().triggered))
+        scan_sample(true, false);
+
+    scan_pulse_start = hal.stepper.pulse_start;
+    hal.stepper.pulse_start = on_scan_pulse_start;
+    scan.active = true;
+
+    cycle_move(target, gc_block->values.f);
+
+    scan_stop();
+    cycle_end();
+
+    scan_drain(true);
+
+    hal.stream.write("[SCANEND:");
+    hal.stream.write(uitoa(scan.head));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(scan.overruns));
+    hal.stream.write("]" ASCII_EOL);
+}
+
+static void probe_map_point (uint_fast16_t ix, uint_fast16_t iy, int16_t z)
+{
+    hal.stream.write("[MAP:");
+    hal.stream.write(uitoa(ix));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(iy));
+    hal.stream.write(",");
+    hal.stream.write(z == PROBE_MAP_NONE ? "-" : ftoa((float)(z - probe_map.z[0]) / 1000.0f, 3));
+    hal.stream.write("]" ASCII_EOL);
+}
+
+// M405 - surface map. Points are probed in a serpentine order, each point is reported as soon as it is probed.
+// Any failed probe aborts the map, points probed so far are kept for $PROBEMAP.
+static void probe_surface_map (parser_block_t *gc_block)
+{
+    uint_fast16_t ix, iy, col;
+    int32_t trigger[N_AXIS];
+    float target[N_AXIS], height;
+    bool ok = true;
+
+    probe_map.nx = (uint16_t)gc_block->values.p;
+    probe_map.ny = (uint16_t)gc_block->values.q;
+    probe_map.pitch[X_AXIS] = gc_block->values.ijk[X_AXIS];
+    probe_map.pitch[Y_AXIS] = gc_block->values.ijk[Y_AXIS];
+    probe_map.probed = 0;
+
+    for(ix = 0; ix < probe_map.nx * probe_map.ny; ix++)
+        probe_map.z[ix] = PROBE_MAP_NONE;
+
+    system_convert_array_steps_to_mpos(probe_map.origin, sys.position);
+    memcpy(target, probe_map.origin, sizeof(target));
+
+    cycle_begin();
+
+    for(iy = 0; ok && iy < probe_map.ny; iy++) {
+        for(col = 0; ok && col < probe_map.nx; col++) {
+
+            ix = iy & 1 ? probe_map.nx - 1 - col : col;
+
+            target[X_AXIS] = probe_map.origin[X_AXIS] + probe_map.pitch[X_AXIS] * ix;
+            target[Y_AXIS] = probe_map.origin[Y_AXIS] + probe_map.pitch[Y_AXIS] * iy;
+            target[Z_AXIS] = probe_map.origin[Z_AXIS];
 
-        protection_off();  //disable protection when probing
+            if((ok = cycle_move(target, 0.0f))) {
 
-        //set polarity before probing the fixture.
-        if(probe_protect_settings.flags.invert)
-            settings.probe.invert_probe_pin = !nvs_invert_probe_pin;
-        
-        //if a different pin is configured, re-direct probe reading to that pin via function pointer.
-        if(probe_protect_settings.flags.tool_pin){
-            report_message("Activating alternate tool pin", Message_Info);
-            //store current probe state function
-            if(hal.probe.get_state)
-                probe_get_state = hal.probe.get_state;
-            hal.probe.get_state = probeGetState;
-        }
-        //set hard limits before probing the fixture.
-        //if(!nvs_hardlimits && probe_protect_settings.flags.hardlimits){ //if the hard limits are not already enabled they need to be enabled.
-        //    hal.limits.enable(settings.limits.flags.hard_enabled, true); // Change immediately. NOTE: Nice to have but could be problematic later.
-        //}
-    }else{
-        if(probe_protect_settings.flags.tool_pin){
-            report_message("Restoring probe pin", Message_Info);
-            //restore probe state function
-            if(probe_get_state)
-                hal.probe.get_state = probe_get_state;
-            probe_get_state = NULL;
+                target[Z_AXIS] -= gc_block->values.ijk[Z_AXIS];
+
+                if((ok = cycle_seek(target, gc_block->values.f, trigger))) {
+
+                    system_convert_array_steps_to_mpos(target, trigger);
+                    height = (target[Z_AXIS] - probe_map.origin[Z_AXIS]) * 1000.0f;
+                    probe_map.z[iy * probe_map.nx + ix] = (int16_t)lroundf(height);
+                    probe_map.probed++;
+
+                    probe_map_point(ix, iy, probe_map.z[iy * probe_map.nx + ix]);
+
+                    target[Z_AXIS] = probe_map.origin[Z_AXIS];
+                    ok = cycle_move(target, 0.0f);
+                }
+            }
         }
-        if(probe_protect_settings.flags.invert)                
-            settings.probe.invert_probe_pin = nvs_invert_probe_pin;  //restore pin inversion setting
-        //hal.limits.enable(settings.limits.flags.hard_enabled, nvs_hardlimits);  //restore hard limit settings.
-        protection_on();      //restore protection.  
     }
-    
-    //typedef bool (*on_probe_toolsetter_ptr)(tool_data_t *tool, coord_data_t *position, bool at_g59_3, bool on)
-    if(on_probe_fixture)
-        status = on_probe_fixture(tool, position, at_g59_3, on);
 
-    return status;
+    cycle_end();
+
+    if(!ok)
+        report_message("Probe plugin: surface map aborted", Message_Warning);
 }
 
-//static void on_probe_connected_toggle(void){
-static void set_connected_status(void *data){    
-    
-    static uint8_t previous_flags;
-    //probe_state_t probe = hal.probe.get_state();
+// $PROBEMAP - output the last surface map, one row per line.
+static status_code_t report_map (sys_state_t state, char *args)
+{
+    uint_fast16_t ix, iy;
+    int16_t z;
+
+    hal.stream.write("[PROBEMAP:");
+    hal.stream.write(uitoa(probe_map.nx));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(probe_map.ny));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(probe_map.pitch[X_AXIS], 3));
+    hal.stream.write(",");
+    hal.stream.write(ftoa(probe_map.pitch[Y_AXIS], 3));
+    hal.stream.write(",");
+    hal.stream.write(uitoa(probe_map.probed));
+    hal.stream.write("]" ASCII_EOL);
+
+    for(iy = 0; iy < probe_map.ny; iy++) {
+        hal.stream.write("[MAPROW:");
+        hal.stream.write(uitoa(iy));
+        for(ix = 0; ix < probe_map.nx; ix++) {
+            z = probe_map.z[iy * probe_map.nx + ix];
+            hal.stream.write(",");
+            hal.stream.write(z == PROBE_MAP_NONE ? "-" : ftoa((float)(z - probe_map.z[0]) / 1000.0f, 3));
+        }
+        hal.stream.write("]" ASCII_EOL);
+    }
 
-    check_connected_pin();
+    return Status_OK;
+}
 
-    if(probe_connected.ext_pin)
-        report_message("External Probe connected!", Message_Info);    
+// Toolsetter keep-out zone. Moves are checked once when planned, a move or jog from outside the box that would
+// enter it is rejected. Moves from inside the box are allowed so the machine can leave it.
+// The travel limits hook is not passed the planner data, so every move is checked and its start is tracked
+// as the end of the previous planned move, taken from the machine position when the planner is empty.
 
-    if (probe_connected.t99)
-        report_message("T99 Probe connected!", Message_Info);
+static void tool_zone_update (void)
+{
+    float g59_3[N_AXIS];
+
+    if((tool_zone.enabled = probe_protect_settings.options.tool_zone && settings_read_coord_data(CoordinateSystem_G59_3, &g59_3))) {
+        tool_zone.min[X_AXIS] = g59_3[X_AXIS] - probe_protect_settings.zone_radius;
+        tool_zone.max[X_AXIS] = g59_3[X_AXIS] + probe_protect_settings.zone_radius;
+        tool_zone.min[Y_AXIS] = g59_3[Y_AXIS] - probe_protect_settings.zone_radius;
+        tool_zone.max[Y_AXIS] = g59_3[Y_AXIS] + probe_protect_settings.zone_radius;
+        tool_zone.min[Z_AXIS] = -INFINITY;
+        tool_zone.max[Z_AXIS] = g59_3[Z_AXIS] + probe_protect_settings.zone_height;
+    }
+}
 
-    if(probe_connected.mcode)
-            report_message("Mcode Probe connected!", Message_Info);
+static inline bool tool_zone_inside (const float *position)
+{
+    return position[X_AXIS] >= tool_zone.min[X_AXIS] && position[X_AXIS] <= tool_zone.max[X_AXIS] &&
+            position[Y_AXIS] >= tool_zone.min[Y_AXIS] && position[Y_AXIS] <= tool_zone.max[Y_AXIS] &&
+             position[Z_AXIS] <= tool_zone.max[Z_AXIS];
+}
 
-    if(probe_connected.toggle)
-            report_message("Probe connect toggled on", Message_Info);
-    
-    if(probe_connected.value){
-        protection_on(); 
-    } else{
-        protection_off(); 
-        if (previous_flags != probe_connected.value)
-            report_message("Probe disconnected, protection off.", Message_Info);
+//slab test of the segment start -> end against the box, t_enter is set to the fraction of the move where it enters.
+static bool tool_zone_intersects (const float *start, const float *end, float *t_enter)
+{
+    uint_fast8_t idx;
+    float t0 = 0.0f, t1 = 1.0f, delta, ta, tb, tmp;
+
+    for(idx = 0; idx < 3; idx++) {
+        delta = end[idx] - start[idx];
+        if(fabsf(delta) < 1e-6f) {
+            if(start[idx] < tool_zone.min[idx] || start[idx] > tool_zone.max[idx])
+                return false;
+        } else {
+            ta = (tool_zone.min[idx] - start[idx]) / delta;
+            tb = (tool_zone.max[idx] - start[idx]) / delta;
+            if(ta > tb) {
+                tmp = ta;
+                ta = tb;
+                tb = tmp;
+            }
+            if(ta > t0)
+                t0 = ta;
+            if(tb < t1)
+                t1 = tb;
+            if(t0 > t1)
+                return false;
+        }
     }
 
-    previous_flags = probe_connected.value;   
+    *t_enter = t0;
+
+    return true;
 }
 
-static void onSpindleSetState (spindle_ptrs_t *spindle, spindle_state_t state, float rpm)
+//returns true if the move from start to end should be blocked.
+static bool tool_zone_blocked (const float *start, const float *end, float *t_enter)
 {
-    //If the probe is connected and the spindle is turning on, alarm.
-    if(probe_connected.value && (state.value !=0)){
-        state.value = 0; //ensure spindle is off
-        grbl.enqueue_realtime_command(CMD_STOP);
-        report_message("PROBE IS IN SPINDLE!", Message_Warning);
-    }
+    if(!(probe_protect_settings.options.tool_zone && sys.homed.x && sys.homed.y) ||
+         probing || cycle_active || fixture_active || state_get() == STATE_TOOL_CHANGE)
+        return false;
 
-    on_spindle_set_state(spindle, state, rpm);
+    //G59.3 can be changed by G10 without a WCO change, it is read from the RAM copy of the settings.
+    tool_zone_update();
+
+    return tool_zone.enabled && !tool_zone_inside(start) && tool_zone_intersects(start, end, t_enter);
 }
 
-static bool onSpindleSelect (spindle_ptrs_t *spindle)
-{   
-    on_spindle_set_state = spindle->set_state;
-    spindle->set_state = onSpindleSetState;
+static bool checkTravelLimits (float *target, axes_signals_t axes, bool is_cartesian)
+{
+    float t_enter;
 
-    return on_spindle_select == NULL || on_spindle_select(spindle);
+    if(!zone_start_valid) {
+        system_convert_array_steps_to_mpos(zone_start, sys.position);
+        zone_start_valid = true;
+    }
+
+    if(tool_zone_blocked(zone_start, target, &t_enter) || !check_travel_limits(target, axes, is_cartesian))
+        return false;
+
+    memcpy(zone_start, target, sizeof(zone_start));
+
+    return true;
 }
 
-static void onToolSelected (tool_data_t *tool)
+//jogs are stopped at the boundary of the zone.
+static void applyJogLimits (float *target, float *position)
 {
-    //probe_state_t probe = hal.probe.get_state();
-    //if the tool is 99, set probe connected.
-    current_tool = tool;
+    uint_fast8_t idx;
+    float t_enter;
 
-    if ((tool->tool_id == 99) && probe_protect_settings.flags.t99_protect){
-        probe_connected.t99 = true;     
-    }else {
-        probe_connected.t99 = false;        
+    apply_jog_limits(target, position);
+
+    if(tool_zone_blocked(position, target, &t_enter)) {
+        t_enter = max(t_enter - 0.001f, 0.0f);
+        for(idx = 0; idx < 3; idx++)
+            target[idx] = position[idx] + (target[idx] - position[idx]) * t_enter;
     }
+}
 
-    set_connected_status(&tool->tool_id);
+static void onStateChange (sys_state_t state)
+{
+    //the planner is empty when idle, the next move starts at the machine position.
+    if(state == STATE_IDLE)
+        zone_start_valid = false;
 
-    if(on_tool_selected)
-        on_tool_selected(tool);
+    if(on_state_change)
+        on_state_change(state);
 }
 
 static void mcode_execute (uint_fast16_t state, parser_block_t *gc_block)
 {
+    METRICS_START();
+
     bool handled = true;
     //probe_state_t probe = hal.probe.get_state();
 
@@ -416,32 +2848,112 @@ static void mcode_execute (uint_fast16_t state, parser_block_t *gc_block)
                 report_message("Probe connected signal not asserted!", Message_Warning);
             break;
 
+        case 403:
+            probe_two_stage(gc_block);
+            break;
+
+        case 404:
+            tool_cache_invalidate((uint32_t)gc_block->values.p);
+            break;
+
+        case 405:
+            probe_surface_map(gc_block);
+            break;
+
+        case 406:
+            probe_repeatability(gc_block);
+            break;
+
+        case 407:
+            if((probe_manual = gc_block->values.p >= 0.0f))
+                probe_base = (probe_source_t)gc_block->values.p;
+            else
+                probe_base = probe_tool_source(current_tool ? current_tool->tool_id : 0);
+            if(!fixture_active)
+                probe_select(probe_base);
+            break;
+
+        case 408:
+            probe_feature(gc_block);
+            break;
+
+        case 409:
+            probe_scan(gc_block);
+            break;
+
         default:
             handled = false;
             break;
     }
 
-    set_connected_status(NULL);  
+    if(handled)
+        set_connected_status(NULL);  
+
+    METRICS_END(Hook_MCodeExecute);
 
     if(!handled && user_mcode.execute)
         user_mcode.execute(state, gc_block);
 }
 
-static void probeConfigure (bool is_probe_away, bool probing)
+static void onExecuteRealtime (uint_fast16_t state)
+{
+    if(accel_axes.mask)
+        probe_accel_restore(); //the probe move has been planned.
+
+    debounce_poll();
+    heartbeat_poll();
+    trace_drain();
+    report_connected();
+
+    if(scan.active)
+        scan_drain(false);
+
+    macro_poll();
+
+    on_execute_realtime(state);
+}
+
+//called by the core right before the probe move is planned and when the probe cycle ends, also when it ends
+//without calling on_probe_completed.
+static void probeConfigure (bool is_probe_away, bool armed)
 {
+    //the input is set up further down the chain first, the cached tool approach checks it.
     if(on_probe_configure)
-        on_probe_configure(is_probe_away, probing);
-    
+        on_probe_configure(is_probe_away, armed);
+
+    if(armed) {
+        if(probe_pending) {
+            //if probe connected, de-activate protection at the start of a probing move machine will stop on activation
+            protection_off();
+            probing = true;
+            latch_arm();
+            tool_cache_approach();
+            probe_accel_raise(probe_axes);
+        }
+    } else {
+        probe_accel_restore();
+        if(probing) {
+            probing = false;
+            latch_disarm(); //a captured trigger position is kept for probe_completed.
+            if(!cycle_active)
+                protection_on();
+        }
+    }
+
+    probe_pending = false;
 }
 
 static void probe_reset (void)
 {
     //settings.probe.invert_probe_pin = nvs_invert_probe_pin;
-    if(probe_get_state){
-        hal.probe.get_state = probe_get_state;
-        probe_get_state = NULL;
-    }   
+    latch_disarm();
+    scan_stop();
+    probe_accel_restore();
+    cycle_active = probing = probe_pending = fixture_active = zone_start_valid = false;
+    if(!probe_select(probe_base))
+        probe_select(probe_base = ProbeSource_Touch);
     hal.limits.enable(settings.limits.flags.hard_enabled, (axes_signals_t)nvs_hardlimits);  //restore hard limit settings.
+    task_add_immediate(tlr_restore, NULL);
     //probe_connected.value = 0;  //seems like it is best for this to survive reset.
     //task_add_immediate(set_connected_status, NULL);
     probe_state_t probe = hal.probe.get_state();
@@ -459,6 +2971,169 @@ static void report_options (bool newopt)
     }       
 }
 
+#if PROBE_PLUGIN_METRICS
+
+// $PROBESTATS - report hook latency statistics, $PROBESTATS=R resets them.
+static status_code_t report_metrics (sys_state_t state, char *args)
+{
+    uint_fast8_t hook, idx;
+
+    if(args && (*args == 'R' || *args == 'r')) {
+        memset(metrics, 0, sizeof(metrics));
+        return Status_OK;
+    }
+
+    for(hook = 0; hook < Hook_N; hook++) {
+        hal.stream.write("[PROBESTATS:");
+        hal.stream.write(hook_name[hook]);
+        hal.stream.write(",");
+        hal.stream.write(uitoa(metrics[hook].count));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(metrics[hook].min));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(metrics[hook].count ? (uint32_t)(metrics[hook].sum / metrics[hook].count) : 0));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(metrics[hook].max));
+        hal.stream.write(",");
+        hal.stream.write(PROBE_METRICS_UNIT);
+        for(idx = 0; idx < PROBE_METRICS_BUCKETS; idx++) {
+            hal.stream.write(idx ? "," : "|");
+            hal.stream.write(uitoa(metrics[hook].bucket[idx]));
+        }
+        hal.stream.write("]" ASCII_EOL);
+    }
+
+    return Status_OK;
+}
+
+#define PROBE_BENCH_READS 1000
+
+// $PROBEBENCH - time PROBE_BENCH_READS reads of the tool probe pin via wait_on_input and via the resolved pin accessor.
+static status_code_t bench_tool_probe (sys_state_t state, char *args)
+{
+    uint32_t idx, t0, elapsed;
+    volatile bool triggered;
+
+    if(!probe_protect_settings.flags.tool_pin)
+        return Status_InvalidStatement;
+
+    t0 = PROBE_METRICS_TIMESTAMP();
+    for(idx = 0; idx < PROBE_BENCH_READS; idx++)
+        triggered = TOOL_PROBE_READ();
+    elapsed = PROBE_METRICS_TIMESTAMP() - t0;
+
+    hal.stream.write("[PROBEBENCH:wait_on_input,");
+    hal.stream.write(uitoa(elapsed));
+    hal.stream.write("," PROBE_METRICS_UNIT "/");
+    hal.stream.write(uitoa(PROBE_BENCH_READS));
+    hal.stream.write("]" ASCII_EOL);
+
+    hal.stream.write("[PROBEBENCH:direct,");
+    if(tool_probe_pin.get_value) {
+        t0 = PROBE_METRICS_TIMESTAMP();
+        for(idx = 0; idx < PROBE_BENCH_READS; idx++)
+            triggered = TOOL_PROBE_READ_DIRECT();
+        elapsed = PROBE_METRICS_TIMESTAMP() - t0;
+        hal.stream.write(uitoa(elapsed));
+        hal.stream.write("," PROBE_METRICS_UNIT "/");
+        hal.stream.write(uitoa(PROBE_BENCH_READS));
+    } else
+        hal.stream.write("n/a");
+    hal.stream.write("]" ASCII_EOL);
+
+    (void)triggered;
+
+    return Status_OK;
+}
+
+#endif
+
+// $PROBETRACE - output the last PROBE_TRACE_SIZE events, oldest first.
+static status_code_t report_trace (sys_state_t state, char *args)
+{
+    trace_entry_t event;
+    uint32_t head = __atomic_load_n(&trace.head, __ATOMIC_ACQUIRE);
+    uint32_t seq = head > PROBE_TRACE_SIZE ? head - PROBE_TRACE_SIZE : 0;
+
+    for(; seq != head; seq++) {
+        if(trace_get(seq, &event) && event.event < Event_N) {
+            hal.stream.write("[PROBETRACE:");
+            hal.stream.write(uitoa(seq));
+            hal.stream.write(",");
+            hal.stream.write(uitoa(event.us));
+            hal.stream.write(",");
+            hal.stream.write(event_name[event.event]);
+            hal.stream.write(",");
+            hal.stream.write(uitoa(event.data));
+            hal.stream.write("]" ASCII_EOL);
+        }
+    }
+
+    return Status_OK;
+}
+
+// $PROBEEDGES - output edge counts and interrupt storm diagnostics per input.
+static status_code_t report_edges (sys_state_t state, char *args)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < Debounce_N; idx++) {
+        hal.stream.write("[PROBEEDGES:");
+        hal.stream.write(debounce[idx].name);
+        hal.stream.write(",");
+        hal.stream.write(uitoa(debounce[idx].edges));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(debounce[idx].max_window_edges));
+        hal.stream.write(",");
+        hal.stream.write(uitoa(debounce[idx].storms));
+        hal.stream.write(debounce[idx].storm ? ",1]" ASCII_EOL : ",0]" ASCII_EOL);
+    }
+
+    return Status_OK;
+}
+
+// $PROBEFEED - output the adaptive probing feed per source, $PROBEFEED=R resets them.
+static status_code_t report_feed (sys_state_t state, char *args)
+{
+    uint_fast8_t idx;
+
+    if(args && (*args == 'R' || *args == 'r')) {
+        memset(probe_feed.feed, 0, sizeof(probe_feed.feed));
+        probe_feed_save();
+    }
+
+    for(idx = 0; idx < ProbeSource_N; idx++) {
+        hal.stream.write("[PROBEFEED:");
+        hal.stream.write(probe_source_name[idx]);
+        hal.stream.write(",");
+        hal.stream.write(ftoa(probe_feed_get((probe_source_t)idx), 1));
+        hal.stream.write(probe_feed.feed[idx] == 0.0f ? ",0]" ASCII_EOL : ",1]" ASCII_EOL);
+    }
+
+    return Status_OK;
+}
+
+static const sys_command_t probe_command_list[] = {
+#if PROBE_PLUGIN_METRICS
+    {"PROBESTATS", report_metrics, { .allow_blocking = On }, { .str = "report probe plugin hook latencies, $PROBESTATS=R to reset" } },
+    {"PROBEBENCH", bench_tool_probe, { .noargs = On, .allow_blocking = On }, { .str = "benchmark tool probe pin read methods" } },
+#endif
+    {"PROBETRACE", report_trace, { .noargs = On, .allow_blocking = On }, { .str = "output the probe plugin event trace" } },
+    {"PROBEEDGES", report_edges, { .noargs = On, .allow_blocking = On }, { .str = "output probe input edge counts and interrupt storm diagnostics" } },
+    {"PROBEMAP", report_map, { .noargs = On, .allow_blocking = On }, { .str = "output the last M405 surface map" } },
+    {"PROBEFEED", report_feed, { .allow_blocking = On }, { .str = "output the adaptive probing feed per source, $PROBEFEED=R to reset" } }
+};
+
+static sys_commands_t probe_commands = {
+    .n_commands = sizeof(probe_command_list) / sizeof(sys_command_t),
+    .commands = probe_command_list
+};
+
+static sys_commands_t *onGetCommands (void)
+{
+    return &probe_commands;
+}
+
 static void warning_msg (void *data)
 {
     report_message("Probe protect plugin failed to initialize!", Message_Warning);
@@ -473,7 +3148,32 @@ static const setting_group_detail_t user_groups [] = {
 static const setting_detail_t user_settings[] = {
     { PROBE_PLUGIN_PORT_SETTING1, Group_Probing, "Probe Connected Aux Input", NULL, Format_Int8, "#0", "0", max_port, Setting_NonCore, &probe_protect_settings.protect_port, NULL, NULL },
     { PROBE_PLUGIN_PORT_SETTING2, Group_Probing, "Tool Probe Aux Input", NULL, Format_Int8, "#0", "0", max_port, Setting_NonCore, &probe_protect_settings.tool_port, NULL, NULL },    
-    { PROBE_PLUGIN_FIXTURE_INVERT_LIMIT_SETTING, Group_Probing, "Probe Protection Flags", NULL, Format_Bitfield, "Invert Tool Probe, External Connected Pin, Invert External Connected Pin, Alternate Tool Probe Pin, Invert Tool Probe Pin, Enable Motion Protection, T99 Probe Connected", NULL, NULL, Setting_NonCore, &probe_protect_settings.flags, NULL, NULL },   
+    { PROBE_PLUGIN_FIXTURE_INVERT_LIMIT_SETTING, Group_Probing, "Probe Protection Flags", NULL, Format_Bitfield, "Invert Tool Probe, External Connected Pin, Invert External Connected Pin, Alternate Tool Probe Pin, Invert Tool Probe Pin, Enable Motion Protection, T99 Probe Connected, Interrupt Motion Protection", NULL, NULL, Setting_NonCore, &probe_protect_settings.flags, NULL, NULL },   
+    { PROBE_PLUGIN_PROTECT_PORT_SETTING, Group_Probing, "Probe Protect Aux Input", NULL, Format_Int8, "#0", "0", max_port, Setting_NonCore, &probe_protect_settings.protect_irq_port, NULL, NULL },
+    { PROBE_PLUGIN_PROBE_DEBOUNCE_SETTING, Group_Probing, "Probe Protect Debounce", "milliseconds", Format_Int16, "##0", "0", "250", Setting_NonCore, &probe_protect_settings.debounce, NULL, NULL },
+    { PROBE_PLUGIN_CONNECT_DEBOUNCE_SETTING, Group_Probing, "Probe Connected Debounce", "milliseconds", Format_Int16, "###0", "0", "1000", Setting_NonCore, &probe_protect_settings.connect_debounce, NULL, NULL },
+    { PROBE_PLUGIN_REPORT_INTERVAL_SETTING, Group_Probing, "Probe Connected Report Interval", "milliseconds", Format_Int16, "####0", "0", "10000", Setting_NonCore, &probe_protect_settings.report_interval, NULL, NULL },
+    { PROBE_PLUGIN_OPTIONS_SETTING, Group_Probing, "Probe Protection Options", NULL, Format_Bitfield, "Connected State In Realtime Report, Store Tool Length Reference, Cache Measured Tool Lengths, Toolsetter Exclusion Zone, Binary Probe Records, Spindle Spin-down Interlock, Connected Input Heartbeat", NULL, NULL, Setting_NonCore, &probe_protect_settings.options, NULL, NULL },
+    { PROBE_PLUGIN_CACHE_AGE_SETTING, Group_Probing, "Tool Cache Max Age", "minutes", Format_Int16, "####0", "0", "65535", Setting_NonCore, &probe_protect_settings.cache_max_age, NULL, NULL },
+    { PROBE_PLUGIN_CACHE_SPINDLE_SETTING, Group_Probing, "Tool Cache Max Spindle Time", "minutes", Format_Int16, "####0", "0", "65535", Setting_NonCore, &probe_protect_settings.cache_max_spindle, NULL, NULL },
+    { PROBE_PLUGIN_ZONE_RADIUS_SETTING, Group_Probing, "Toolsetter Zone Radius", "mm", Format_Decimal, "##0.0", "0", "500", Setting_NonCore, &probe_protect_settings.zone_radius, NULL, NULL },
+    { PROBE_PLUGIN_ZONE_HEIGHT_SETTING, Group_Probing, "Toolsetter Zone Height", "mm", Format_Decimal, "-##0.0", "-500", "500", Setting_NonCore, &probe_protect_settings.zone_height, NULL, NULL },
+    { PROBE_PLUGIN_OVERTRAVEL_SETTING, Group_Probing, "Probe Overtravel Limit", "mm", Format_Decimal, "#0.000", "0", "10", Setting_NonCore, &probe_protect_settings.overtravel_limit, NULL, NULL },
+    { PROBE_PLUGIN_FEED_MIN_SETTING, Group_Probing, "Adaptive Probe Feed Min", "mm/min", Format_Decimal, "####0.0", "1", "10000", Setting_NonCore, &probe_protect_settings.feed_min, NULL, NULL },
+    { PROBE_PLUGIN_FEED_MAX_SETTING, Group_Probing, "Adaptive Probe Feed Max", "mm/min", Format_Decimal, "####0.0", "1", "10000", Setting_NonCore, &probe_protect_settings.feed_max, NULL, NULL },
+    { PROBE_PLUGIN_PROBE_ACCEL_SETTING, Group_Probing, "Probing Acceleration", "%", Format_Int16, "###0", "100", "1000", Setting_NonCore, &probe_protect_settings.probe_accel, NULL, NULL },
+    { PROBE_PLUGIN_SOURCE2_PORT_SETTING, Group_Probing, "Toolsetter 2 Aux Input", NULL, Format_Int8, "#0", "0", max_port, Setting_NonCore, &probe_protect_settings.source[0].port, NULL, NULL },
+    { PROBE_PLUGIN_SOURCE2_FLAGS_SETTING, Group_Probing, "Toolsetter 2 Flags", NULL, Format_Bitfield, "Enable, Invert, Use At G59.3, Select By Tool, Connected From Probe Connected Sources", NULL, NULL, Setting_NonCore, &probe_protect_settings.source[0].flags, NULL, NULL },
+    { PROBE_PLUGIN_SOURCE2_TOOL_SETTING, Group_Probing, "Toolsetter 2 Tool", NULL, Format_Int16, "####0", "0", "65535", Setting_NonCore, &probe_protect_settings.source[0].tool, NULL, NULL },
+    { PROBE_PLUGIN_SOURCE3_PORT_SETTING, Group_Probing, "Wireless Probe Aux Input", NULL, Format_Int8, "#0", "0", max_port, Setting_NonCore, &probe_protect_settings.source[1].port, NULL, NULL },
+    { PROBE_PLUGIN_SOURCE3_FLAGS_SETTING, Group_Probing, "Wireless Probe Flags", NULL, Format_Bitfield, "Enable, Invert, Use At G59.3, Select By Tool, Connected From Probe Connected Sources", NULL, NULL, Setting_NonCore, &probe_protect_settings.source[1].flags, NULL, NULL },
+    { PROBE_PLUGIN_SOURCE3_TOOL_SETTING, Group_Probing, "Wireless Probe Tool", NULL, Format_Int16, "####0", "0", "65535", Setting_NonCore, &probe_protect_settings.source[1].tool, NULL, NULL },
+    { PROBE_PLUGIN_TIP_DIAMETER_SETTING, Group_Probing, "Probe Tip Diameter", "mm", Format_Decimal, "#0.000", "0", "20", Setting_NonCore, &probe_protect_settings.tip_diameter, NULL, NULL },
+    { PROBE_PLUGIN_CONNECT_MACRO_SETTING, Group_Probing, "Probe Connect Macro", NULL, Format_String, "x(95)", NULL, "95", Setting_NonCore, macro_settings.connect, NULL, NULL },
+    { PROBE_PLUGIN_DISCONNECT_MACRO_SETTING, Group_Probing, "Probe Disconnect Macro", NULL, Format_String, "x(95)", NULL, "95", Setting_NonCore, macro_settings.disconnect, NULL, NULL },
+    { PROBE_PLUGIN_SPINDOWN_SETTING, Group_Probing, "Tool Change Spindle Spin-down Time", "milliseconds", Format_Int16, "####0", "0", "30000", Setting_NonCore, &probe_protect_settings.spindown_time, NULL, NULL },
+    { PROBE_PLUGIN_HEARTBEAT_SETTING, Group_Probing, "Probe Heartbeat Timeout", "milliseconds", Format_Int16, "####0", "10", "10000", Setting_NonCore, &probe_protect_settings.heartbeat_timeout, NULL, NULL },
+    { PROBE_PLUGIN_CACHE_CLEARANCE_SETTING, Group_Probing, "Tool Cache Approach Clearance", "mm", Format_Decimal, "#0.000", "0.1", "50", Setting_NonCore, &probe_protect_settings.cache_clearance, NULL, NULL },
 };
 
 #ifndef NO_SETTINGS_DESCRIPTIONS
@@ -492,16 +3192,117 @@ static const setting_descr_t probe_protect_settings_descr[] = {
                             "Invert alternate pin input for Tool Probe signal.\\n"    
                             "Enable probe motion protection.  Alarm will trip if probe is asserted on non-probing moves (Experimental).\\n"
                             "Enable probe protection on T99.  Spindle is disabled when T99 (probe) is selected.\\n"                          
+                            "Use an edge interrupt on the probe protect aux input instead of checking the probe on every step pulse.\\n"
                             "NOTE: A hard reset of the controller is required after changing this setting."
     },   
+    { PROBE_PLUGIN_PROTECT_PORT_SETTING, "Aux input port number wired in parallel with the probe input, used for interrupt driven motion protection.\\n"
+                            "If the port can not generate interrupts motion protection falls back to checking the probe on every step pulse.\\n\\n"
+                            "NOTE: A hard reset of the controller is required after changing this setting."
+    },
+    { PROBE_PLUGIN_PROBE_DEBOUNCE_SETTING, "Time the probe has to stay asserted during a protected move before the alarm is raised."
+    },
+    { PROBE_PLUGIN_CONNECT_DEBOUNCE_SETTING, "Time the probe connected aux input has to be stable before a change is accepted, increase if relay is slow and/or bouncy."
+    },
+    { PROBE_PLUGIN_REPORT_INTERVAL_SETTING, "Minimum time between probe connected messages. Changes within the interval are coalesced and only the resulting state is reported."
+    },
+    { PROBE_PLUGIN_OPTIONS_SETTING, "Add a |PRC: field to the realtime report while the probe is connected, listing the active sources:\\n"
+                            "E - external pin, T - T99, M - M401, C - connect toggle.\\n"
+                            "Keep the tool length reference and the last measured tool length offsets in non volatile storage and restore the reference on startup.\\n"
+                            "NOTE: The restored reference is only valid if the machine is homed.\\n"
+                            "Cache the toolsetter contact of measured tools. When a cached tool is measured again the machine rapids to just above\\n"
+                            "the expected contact and the probe move only verifies the length. Use M404 to invalidate the cache after touching a tool.\\n"
+                            "Reject moves and stop jogs that would enter the box around the G59.3 position, except probing and tool changes.\\n"
+                            "Requires the machine to be homed, moves are only checked with soft limits enabled and jogs only with jog limiting enabled.\\n"
+                            "Output a compact binary record after each probe move in addition to the [PRB:] report, see the plugin README for the format.\\n"
+                            "Hold the toolsetter probe move until the spindle has been off for the spin-down time, refuse it while the spindle is on.\\n"
+                            "Treat the external connected pin as a heartbeat from a wireless probe receiver: the probe is connected while pulses arrive."
+    },
+    { PROBE_PLUGIN_CACHE_AGE_SETTING, "Time after which a cached tool length is measured in full again, 0 for no limit."
+    },
+    { PROBE_PLUGIN_CACHE_SPINDLE_SETTING, "Spindle run time after which a cached tool length is measured in full again, 0 for no limit."
+    },
+    { PROBE_PLUGIN_ZONE_RADIUS_SETTING, "Half width in X and Y of the toolsetter exclusion zone, centered on the G59.3 position."
+    },
+    { PROBE_PLUGIN_ZONE_HEIGHT_SETTING, "Top of the toolsetter exclusion zone relative to the G59.3 Z position."
+    },
+    { PROBE_PLUGIN_OVERTRAVEL_SETTING, "Max distance travelled after the probe triggers. When set the probing feed is tuned per probe source\\n"
+                            "so the overtravel stays below this limit. The seek moves of the M403, M405 and M408 cycles and the toolsetter seek of a tool change\\n"
+                            "run at the tuned feed, other requested feeds above it are reduced. 0 to disable."
+    },
+    { PROBE_PLUGIN_FEED_MIN_SETTING, "Lowest probing feed the adaptive feed may select."
+    },
+    { PROBE_PLUGIN_FEED_MAX_SETTING, "Highest probing feed the adaptive feed may select, also the starting value before a source is tuned."
+    },
+    { PROBE_PLUGIN_PROBE_ACCEL_SETTING, "Acceleration of the axes moved by a probe move in percent of the normal values, other moves are not affected\\n"
+                            "and the stored axis settings are not changed.\\n"
+                            "A higher value shortens the overtravel after the probe triggers. 100 to use the normal values."
+    },
+    { PROBE_PLUGIN_SOURCE2_PORT_SETTING, "Aux input port number to use for the second toolsetter.\\n\\n"
+                            "NOTE: A hard reset of the controller is required after changing this setting."
+    },
+    { PROBE_PLUGIN_SOURCE2_FLAGS_SETTING, "Enable the second toolsetter and invert its input.\\n"
+                            "Use it for tool probing at G59.3 instead of the toolsetter, only for the configured tool if selected by tool.\\n"
+                            "Otherwise select by tool selects it as the probe while the configured tool is selected.\\n"
+                            "Take the connected state from the probe connected sources instead of always connected."
+    },
+    { PROBE_PLUGIN_SOURCE2_TOOL_SETTING, "Tool number used for selecting the second toolsetter."
+    },
+    { PROBE_PLUGIN_SOURCE3_PORT_SETTING, "Aux input port number to use for the wireless probe.\\n\\n"
+                            "NOTE: A hard reset of the controller is required after changing this setting."
+    },
+    { PROBE_PLUGIN_SOURCE3_FLAGS_SETTING, "Enable the wireless probe and invert its input.\\n"
+                            "Use it for tool probing at G59.3 instead of the toolsetter, only for the configured tool if selected by tool.\\n"
+                            "Otherwise select by tool selects it as the probe while the configured tool is selected.\\n"
+                            "Take the connected state from the probe connected sources instead of always connected."
+    },
+    { PROBE_PLUGIN_SOURCE3_TOOL_SETTING, "Tool number used for selecting the wireless probe."
+    },
+    { PROBE_PLUGIN_TIP_DIAMETER_SETTING, "Effective diameter of the probe stylus ball, used by the M408 probing cycles to compensate touch positions."
+    },
+    { PROBE_PLUGIN_CONNECT_MACRO_SETTING, "G-code run when the probe becomes connected, separate lines with |. Example: G53G0Z-5|M64P0\\n"
+                            "Only run for the external connected pin and if no job is running, lines are submitted one at a time when the controller is idle."
+    },
+    { PROBE_PLUGIN_DISCONNECT_MACRO_SETTING, "G-code run when the probe is disconnected, separate lines with |.\\n"
+                            "Only run for the external connected pin and if no job is running, lines are submitted one at a time when the controller is idle."
+    },
+    { PROBE_PLUGIN_SPINDOWN_SETTING, "Time the spindle needs to stop. With the spin-down interlock option the toolsetter probe move\\n"
+                            "waits until the spindle has been off for this time."
+    },
+    { PROBE_PLUGIN_HEARTBEAT_SETTING, "With the heartbeat option the probe is disconnected when no pulse edge has been seen on the\\n"
+                            "external connected pin for this time. Set it a little longer than the receiver pulse interval."
+    },
+    { PROBE_PLUGIN_CACHE_CLEARANCE_SETTING, "Distance above the expected toolsetter contact where the approach of a cached tool ends and the\n"
+                            "probe move continues at its own feed. The approach runs at the tool change seek rate and stops on contact."
+    },
 };
 
 #endif
 
+//the macros are disabled if there was no room for their NVS block.
+static void macro_settings_apply (void)
+{
+    macro_settings.connect[PROBE_MACRO_LENGTH] = macro_settings.disconnect[PROBE_MACRO_LENGTH] = '\0';
+    macro_compile(&connect_macro, macro_address ? macro_settings.connect : "");
+    macro_compile(&disconnect_macro, macro_address ? macro_settings.disconnect : "");
+}
+
+static void macro_settings_restore (void)
+{
+    *macro_settings.connect = *macro_settings.disconnect = '\0';
+
+    if(macro_address)
+        hal.nvs.memcpy_to_nvs(macro_address, (uint8_t *)&macro_settings, sizeof(probe_macro_settings_t), true);
+}
+
 // Write settings to non volatile storage (NVS).
 static void plugin_settings_save (void)
 {
     hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&probe_protect_settings, sizeof(probe_protect_settings_t), true);
+
+    if(macro_address)
+        hal.nvs.memcpy_to_nvs(macro_address, (uint8_t *)&macro_settings, sizeof(probe_macro_settings_t), true);
+
+    macro_settings_apply();
 }
 
 // Restore default settings and write to non volatile storage (NVS).
@@ -510,10 +3311,31 @@ static void plugin_settings_restore (void)
 {
     probe_protect_settings.protect_port = hal.port.num_digital_out ? hal.port.num_digital_out - 1 : 0;
     probe_protect_settings.tool_port = hal.port.num_digital_out ? hal.port.num_digital_out - 1 : 0;
+    probe_protect_settings.protect_irq_port = hal.port.num_digital_out ? hal.port.num_digital_out - 1 : 0;
     probe_protect_settings.flags.value = 0;
     probe_protect_settings.flags.t99_protect = 1;
+    probe_protect_settings.debounce = PROBE_DEBOUNCE;
+    probe_protect_settings.connect_debounce = RELAY_DEBOUNCE;
+    probe_protect_settings.report_interval = CONNECTED_REPORT_INTERVAL;
+    probe_protect_settings.options.value = 0;
+    probe_protect_settings.cache_max_age = 60;
+    probe_protect_settings.cache_max_spindle = 0;
+    probe_protect_settings.zone_radius = TOOLSETTER_RADIUS;
+    probe_protect_settings.zone_height = 0.0f;
+    probe_protect_settings.overtravel_limit = 0.0f;
+    probe_protect_settings.feed_min = 10.0f;
+    probe_protect_settings.feed_max = 1000.0f;
+    probe_protect_settings.probe_accel = 100;
+    memset(probe_protect_settings.source, 0, sizeof(probe_protect_settings.source));
+    probe_protect_settings.source[ProbeSource_Wireless - ProbeSource_Toolsetter2].tool = 99;
+    probe_protect_settings.tip_diameter = 0.0f;
+    probe_protect_settings.spindown_time = 0;
+    probe_protect_settings.heartbeat_timeout = 500;
+    probe_protect_settings.cache_clearance = PROBE_CACHE_CLEARANCE;
 
     hal.nvs.memcpy_to_nvs(nvs_address, (uint8_t *)&probe_protect_settings, sizeof(probe_protect_settings_t), true);
+
+    macro_settings_restore();
 }
 
 static void warning_no_port (void *data)
@@ -521,10 +3343,54 @@ static void warning_no_port (void *data)
     report_message("Probe plugin: configured port number is not available", Message_Warning);
 }
 
+static void warning_no_macro_nvs (void *data)
+{
+    report_message("Probe plugin: not enough NVS for the connect macros, macros disabled", Message_Warning);
+}
+
+static void warning_no_irq (void *data)
+{
+    report_message("Probe plugin: protect port is not interrupt capable, polling probe on step pulses", Message_Warning);
+}
+
+static const char *const probe_source_descr[ProbeSource_N] = {
+    NULL,
+    NULL,
+    "Toolsetter 2",
+    "Wireless probe"
+};
+
+//claims the aux input of an additional probe source.
+static void probe_source_setup (probe_source_t id)
+{
+    probe_source_settings_t *cfg = probe_source_settings(id);
+    probe_source_entry_t *source = &probe_source[id];
+
+    memset(source, 0, sizeof(probe_source_entry_t));
+
+    if(!cfg->flags.enabled)
+        return;
+
+    source->port = cfg->port;
+
+    if(source->port >= n_ports || !ioport_claim(Port_Digital, Port_Input, &source->port, probe_source_descr[id])) {
+        task_add_immediate(warning_no_port, NULL);
+        return;
+    }
+
+    source->aux = true;
+    source->invert = cfg->flags.invert;
+    source->ext_connect = cfg->flags.ext_connect;
+    pin_resolve(source->port, &source->pin);
+    source->get_state = id == ProbeSource_Toolsetter2 ? toolsetter2GetState : wirelessGetState;
+}
+
 // Load our settings from non volatile storage (NVS).
 // If load fails restore to default values.
 static void plugin_settings_load (void)
 {
+    probe_source_t idx;
+
     if(hal.nvs.memcpy_from_nvs((uint8_t *)&probe_protect_settings, nvs_address, sizeof(probe_protect_settings_t), true) != NVS_TransferResult_OK)
         plugin_settings_restore();
 
@@ -535,21 +3401,35 @@ static void plugin_settings_load (void)
     if(probe_protect_settings.tool_port >= n_ports)
         probe_protect_settings.tool_port = n_ports - 2;        
 
+    if(probe_protect_settings.protect_irq_port >= n_ports)
+        probe_protect_settings.protect_irq_port = n_ports - 1;
+
     probe_connect_port = probe_protect_settings.protect_port;
     tool_probe_port = probe_protect_settings.tool_port;
+    protect_irq_port = probe_protect_settings.protect_irq_port;
     nvs_hardlimits = settings.limits.flags.hard_enabled;
+    debounce[Debounce_Probe].window = probe_protect_settings.debounce;
+
+    check_connected_pin = probe_protect_settings.flags.ext_pin && probe_protect_settings.options.heartbeat
+                           ? check_connected_heartbeat
+                           : check_connected_variant[probe_protect_settings.flags.ext_pin][probe_protect_settings.flags.ext_pin_inv];
+    heartbeat_ms = hal.get_elapsed_ticks() - probe_protect_settings.heartbeat_timeout; // not alive until the first pulse.
+    heartbeat_alive = false;
+    fixture_setup = fixture_on_variant[probe_protect_settings.flags.invert];
+    fixture_restore = fixture_off_variant[probe_protect_settings.flags.invert];
+    debounce[Debounce_Connect].window = probe_protect_settings.connect_debounce;
     nvs_invert_probe_pin = settings.probe.invert_probe_pin;
 
-    memcpy(&user_mcode, &grbl.user_mcode, sizeof(user_mcode_ptrs_t));
-
     if(probe_protect_settings.flags.ext_pin){
         if(ioport_claim(Port_Digital, Port_Input, &probe_connect_port, "Probe Connected")) {
         } else
             task_add_immediate(warning_no_port, NULL);    
 
         //Try to register the interrupt handler.
-        if(!(hal.port.register_interrupt_handler(probe_connect_port, IRQ_Mode_Change, set_connected)))
+        if(!(hal.port.register_interrupt_handler(probe_connect_port, IRQ_Mode_Change, check_connected_pin == check_connected_heartbeat ? on_heartbeat : set_connected)))
             task_add_immediate(warning_no_port, NULL);
+
+        debounce_sync(Debounce_Connect);
     }
 
     if(probe_protect_settings.flags.tool_pin){
@@ -558,6 +3438,56 @@ static void plugin_settings_load (void)
             task_add_immediate(warning_no_port, NULL);    
         //Not an interrupt pin.
     }
+
+    if(tlr_address && hal.nvs.memcpy_from_nvs((uint8_t *)&tlr, tlr_address, sizeof(tlr_data_t), false) != NVS_TransferResult_OK)
+        memset(&tlr, 0, sizeof(tlr_data_t));
+
+    task_add_immediate(tlr_restore, NULL);
+    task_add_immediate(tlr_seed_cache, NULL);
+
+    if(!(macro_address && hal.nvs.memcpy_from_nvs((uint8_t *)&macro_settings, macro_address, sizeof(probe_macro_settings_t), true) == NVS_TransferResult_OK))
+        macro_settings_restore();
+
+    macro_settings_apply();
+
+    if(!(feed_address && hal.nvs.memcpy_from_nvs((uint8_t *)&probe_feed, feed_address, sizeof(probe_feed_data_t), false) == NVS_TransferResult_OK &&
+          probe_feed.crc == crc8(&probe_feed, offsetof(probe_feed_data_t, crc))))
+        memset(&probe_feed, 0, sizeof(probe_feed_data_t));
+
+    tool_probe_get_state = probe_get_state_variant[probe_protect_settings.flags.tool_pin && pin_resolve(tool_probe_port, &tool_probe_pin)][probe_protect_settings.flags.tool_pin_inv];
+
+    probe_source[ProbeSource_Touch].get_state = core_probe_get_state;
+
+    if((probe_source[ProbeSource_Toolsetter].aux = probe_protect_settings.flags.tool_pin)) {
+        probe_source[ProbeSource_Toolsetter].get_state = tool_probe_get_state;
+        probe_source[ProbeSource_Toolsetter].port = tool_probe_port;
+    } else
+        probe_source[ProbeSource_Toolsetter].get_state = core_probe_get_state; // toolsetter wired to the probe input.
+
+    probe_source_setup(ProbeSource_Toolsetter2);
+    probe_source_setup(ProbeSource_Wireless);
+
+    //use an edge interrupt on the aux inputs for trigger position capture if supported.
+    for(idx = ProbeSource_Toolsetter; idx < ProbeSource_N; idx++) {
+        if((probe_source[idx].latch_irq = probe_source[idx].aux && hal.port.register_interrupt_handler(probe_source[idx].port, IRQ_Mode_Change, on_source_latch)))
+            hal.port.register_interrupt_handler(probe_source[idx].port, IRQ_Mode_None, NULL);
+    }
+
+    if(!probe_select(probe_base))
+        probe_select(probe_base = ProbeSource_Touch);
+
+    protect_irq_ok = false;
+
+    if(probe_protect_settings.flags.protect_irq){
+        if(ioport_claim(Port_Digital, Port_Input, &protect_irq_port, "Probe Protect")) {
+            //Check that the port is interrupt capable, the handler is only armed while protection is on.
+            if((protect_irq_ok = hal.port.register_interrupt_handler(protect_irq_port, IRQ_Mode_Change, on_probe_edge)))
+                hal.port.register_interrupt_handler(protect_irq_port, IRQ_Mode_None, NULL);
+            else
+                task_add_immediate(warning_no_irq, NULL);
+        } else
+            task_add_immediate(warning_no_port, NULL);
+    }
 }
 
 // Settings descriptor used by the core when interacting with this plugin.
@@ -575,6 +3505,33 @@ static setting_details_t setting_details = {
     .restore = plugin_settings_restore
 };
 
+static setting_id_t settings_taken;
+
+static void warning_settings_taken (void *data)
+{
+    char msg[64];
+
+    strcpy(msg, "Probe plugin: setting $");
+    strcat(msg, uitoa(settings_taken));
+    strcat(msg, " in use, extended settings disabled");
+    report_message(msg, Message_Warning);
+}
+
+// Returns false if any id of the plugin's own block is already registered by the core or another plugin.
+static bool settings_ids_free (void)
+{
+    uint_fast8_t idx;
+
+    for(idx = PROBE_PLUGIN_BASE_SETTINGS; idx < sizeof(user_settings) / sizeof(setting_detail_t); idx++) {
+        if(setting_get_details(user_settings[idx].id, NULL)) {
+            settings_taken = user_settings[idx].id;
+            return false;
+        }
+    }
+
+    return true;
+}
+
 void probe_protect_init (void)
 {
     bool ok = (n_ports = ioports_available(Port_Digital, Port_Input));
@@ -593,6 +3550,15 @@ void probe_protect_init (void)
     on_probe_start = grbl.on_probe_start;
     grbl.on_probe_start = probe_start;
 
+    check_travel_limits = grbl.check_travel_limits;
+    grbl.check_travel_limits = checkTravelLimits;
+
+    apply_jog_limits = grbl.apply_jog_limits;
+    grbl.apply_jog_limits = applyJogLimits;
+
+    on_state_change = grbl.on_state_change;
+    grbl.on_state_change = onStateChange;
+
     on_spindle_select = grbl.on_spindle_select;
     grbl.on_spindle_select = onSpindleSelect;
 
@@ -601,15 +3567,37 @@ void probe_protect_init (void)
 
     driver_reset = hal.driver_reset;
     hal.driver_reset = probe_reset;
+
+    on_execute_realtime = grbl.on_execute_realtime;
+    grbl.on_execute_realtime = onExecuteRealtime;
+
+    on_realtime_report = grbl.on_realtime_report;
+    grbl.on_realtime_report = onRealtimeReport;
+
+    probe_commands.on_get_commands = grbl.on_get_commands;
+    grbl.on_get_commands = onGetCommands;
+
+    debounce[Debounce_Probe].name = "probe";
+    debounce[Debounce_Probe].read = probe_read;
+    debounce[Debounce_Probe].confirmed = probe_confirmed;
+    debounce[Debounce_Probe].window = PROBE_DEBOUNCE;
+    debounce[Debounce_Connect].name = "connected";
+    debounce[Debounce_Connect].read = connect_read;
+    debounce[Debounce_Connect].confirmed = connect_confirmed;
+    debounce[Debounce_Connect].window = RELAY_DEBOUNCE;
     
     on_probe_configure = hal.probe.configure;
     hal.probe.configure = probeConfigure;
 
-    //note that these do not chain.
+    core_probe_get_state = hal.probe.get_state;
+    probe_source[ProbeSource_Touch].get_state = probe_source[ProbeSource_Toolsetter].get_state = core_probe_get_state;
+    hal.probe.get_state = probe_router;
+
+    //M-codes not handled here are passed on to the handlers saved before ours are installed.
+    memcpy(&user_mcode, &grbl.user_mcode, sizeof(user_mcode_ptrs_t));
     grbl.user_mcode.check = mcode_check;
     grbl.user_mcode.validate = mcode_validate;
     grbl.user_mcode.execute = mcode_execute;   
-    memcpy(&user_mcode, &grbl.user_mcode, sizeof(user_mcode_ptrs_t)); 
 
     if(!ioport_can_claim_explicit()) {
 
@@ -631,9 +3619,21 @@ void probe_protect_init (void)
 
     } else if((ok = (nvs_address = nvs_alloc(sizeof(probe_protect_settings_t))))) {
 
+        tlr_address = nvs_alloc(sizeof(tlr_data_t));
+        feed_address = nvs_alloc(sizeof(probe_feed_data_t));
+
+        if(!(macro_address = nvs_alloc(sizeof(probe_macro_settings_t))))
+            task_add_immediate(warning_no_macro_nvs, NULL);
+
         on_report_options = grbl.on_report_options;
         grbl.on_report_options = report_options;
 
+        // Fall back to the aux input settings rather than registering ids twice, the other values keep their defaults or stored values.
+        if(!settings_ids_free()) {
+            setting_details.n_settings = PROBE_PLUGIN_BASE_SETTINGS;
+            task_add_immediate(warning_settings_taken, NULL);
+        }
+
         settings_register(&setting_details);
 
         // Used for setting value validation
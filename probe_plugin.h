@@ -30,12 +30,14 @@
 #include "../../grbl/state_machine.h"
 #include "../../grbl/report.h"
 #include "../../grbl/nvs_buffer.h"
+#include "../../grbl/motion_control.h"
 #else
 #include "grbl/hal.h"
 #include "grbl/protocol.h"
 #include "grbl/state_machine.h"
 #include "grbl/report.h"
 #include "grbl/nvs_buffer.h"
+#include "grbl/motion_control.h"
 #endif
 
 /**/
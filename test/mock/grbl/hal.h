@@ -0,0 +1,527 @@
+/*
+
+  hal.h - host build stub
+
+  Minimal subset of the grblHAL core API used by probe_plugin.c, laid out for host builds of the
+  plugin only. Types are reduced to the members the plugin and the mock core (mock.c) access.
+
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ISR_CODE
+#define ASCII_EOL "\r\n"
+
+#define N_AXIS 3
+#define X_AXIS 0
+#define Y_AXIS 1
+#define Z_AXIS 2
+
+#define On 1
+#define Off 0
+
+#define STATE_IDLE 0
+#define STATE_CHECK_MODE 1
+#define STATE_CYCLE 8
+#define STATE_JOG 32
+#define STATE_TOOL_CHANGE 64
+
+#define CMD_STOP 0x19
+#define CMD_PROBE_CONNECTED_TOGGLE 0x9E
+
+#define TOOLSETTER_RADIUS 5.0f
+#define N_TOOLS 16
+
+#define bit(n) (1UL << (n))
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+
+typedef uint_fast16_t sys_state_t;
+
+typedef enum {
+    Status_OK = 0,
+    Status_BadNumberFormat = 2,
+    Status_InvalidStatement = 3,
+    Status_IdleError = 8,
+    Status_TravelExceeded = 15,
+    Status_GcodeUnsupportedCommand = 20,
+    Status_GcodeUndefinedFeedRate = 22,
+    Status_ProbeFailInitial = 23,
+    Status_GcodeValueWordMissing = 28,
+    Status_GcodeValueOutOfRange = 30,
+    Status_GCodeToolError = 38,
+    Status_Unhandled = 200,
+    Status_GcodeIllegalCommand = 0xF0
+} status_code_t;
+
+typedef enum {
+    Message_Info,
+    Message_Warning,
+    Message_Plain
+} message_type_t;
+
+typedef union {
+    uint8_t value;
+    uint8_t mask;
+    struct {
+        uint8_t x :1,
+                y :1,
+                z :1;
+    };
+} axes_signals_t;
+
+typedef struct {
+    uint8_t triggered :1,
+            connected :1;
+} probe_state_t;
+
+typedef struct {
+    float values[N_AXIS];
+    struct {
+        float x, y, z;
+    };
+} coord_data_t;
+
+typedef struct {
+    float offset[N_AXIS];
+    float radius;
+    uint32_t tool_id;
+} tool_data_t;
+
+typedef union {
+    uint8_t value;
+    struct {
+        uint8_t on       :1,
+                ccw      :1,
+                at_speed :1;
+    };
+} spindle_state_t;
+
+typedef struct {
+    float rpm;
+} spindle_data_t;
+
+typedef struct spindle_ptrs spindle_ptrs_t;
+typedef void (*spindle_set_state_ptr)(spindle_ptrs_t *spindle, spindle_state_t state, float rpm);
+
+struct spindle_ptrs {
+    spindle_set_state_ptr set_state;
+    spindle_state_t (*get_state)(spindle_ptrs_t *spindle);
+    spindle_data_t *(*get_data)(int req);
+};
+
+typedef struct {
+    uint32_t dummy;
+    int32_t step_count;
+} stepper_t;
+
+typedef struct {
+    struct {
+        uint8_t rapid_motion     :1,
+                system_motion    :1,
+                no_feed_override :1,
+                jog_motion       :1,
+                inverse_time     :1;
+    } condition;
+    float feed_rate;
+    float rate_multiplier;
+    struct {
+        float rpm;
+    } spindle;
+} plan_line_data_t;
+
+typedef struct {
+    uint8_t probe_is_away     :1,
+            probe_is_no_error :1;
+} gc_parser_flags_t;
+
+typedef enum {
+    GCProbe_CheckMode,
+    GCProbe_Found,
+    GCProbe_Abort,
+    GCProbe_FailInit,
+    GCProbe_FailEnd
+} gc_probe_t;
+
+typedef uint16_t user_mcode_t;
+
+typedef enum {
+    UserMCode_Unsupported = 0,
+    UserMCode_Normal = 1,
+    UserMCode_NoValueWords = 2
+} user_mcode_type_t;
+
+typedef union {
+    uint32_t mask;
+    struct {
+        uint32_t c :1, d :1, e :1, f :1, h :1, i :1, j :1, k :1, l :1, n :1, o :1,
+                 p :1, q :1, r :1, s :1, t :1, u :1, v :1, w :1, x :1, y :1, z :1;
+    };
+} parameter_words_t;
+
+typedef struct {
+    float d, e, f, h;
+    float ijk[3];
+    float k, l, p, q, r, s;
+    float xyz[N_AXIS];
+    uint32_t t;
+} gc_values_t;
+
+typedef struct {
+    user_mcode_t user_mcode;
+    bool user_mcode_sync;
+    parameter_words_t words;
+    gc_values_t values;
+} parser_block_t;
+
+typedef enum {
+    MotionMode_Seek = 0,
+    MotionMode_Linear = 1,
+    MotionMode_ProbeToward = 140
+} motion_mode_t;
+
+typedef struct {
+    float xyz[N_AXIS];
+    uint8_t id;
+} coord_system_t;
+
+typedef struct {
+    struct {
+        motion_mode_t motion;
+        coord_system_t coord_system;
+    } modal;
+    float position[N_AXIS];
+    float g92_coord_offset[N_AXIS];
+    float tool_length_offset[N_AXIS];
+    tool_data_t *tool;
+    bool file_run;
+} parser_state_t;
+
+extern parser_state_t gc_state;
+
+typedef user_mcode_type_t (*user_mcode_check_ptr)(user_mcode_t mcode);
+typedef status_code_t (*user_mcode_validate_ptr)(parser_block_t *gc_block);
+typedef void (*user_mcode_execute_ptr)(uint_fast16_t state, parser_block_t *gc_block);
+
+typedef struct {
+    user_mcode_check_ptr check;
+    user_mcode_validate_ptr validate;
+    user_mcode_execute_ptr execute;
+} user_mcode_ptrs_t;
+
+typedef void (*driver_reset_ptr)(void);
+typedef void (*on_report_options_ptr)(bool newopt);
+typedef bool (*on_probe_start_ptr)(axes_signals_t axes, float *target, plan_line_data_t *pl_data);
+typedef void (*on_probe_completed_ptr)(void);
+typedef bool (*on_probe_toolsetter_ptr)(tool_data_t *tool, coord_data_t *position, bool at_g59_3, bool on);
+typedef bool (*on_spindle_select_ptr)(spindle_ptrs_t *spindle);
+typedef void (*stepper_pulse_start_ptr)(stepper_t *stepper);
+typedef void (*on_tool_selected_ptr)(tool_data_t *tool);
+typedef void (*on_tool_changed_ptr)(tool_data_t *tool);
+typedef probe_state_t (*probe_get_state_ptr)(void);
+typedef void (*probe_configure_ptr)(bool is_probe_away, bool probing);
+typedef void (*foreground_task_ptr)(void *data);
+typedef void (*delay_callback_ptr)(void);
+typedef bool (*enqueue_realtime_command_ptr)(char c);
+typedef void (*on_execute_realtime_ptr)(uint_fast16_t state);
+typedef void (*stream_write_ptr)(const char *s);
+
+typedef union {
+    uint32_t value;
+} report_tracking_flags_t;
+
+typedef void (*on_realtime_report_ptr)(stream_write_ptr stream_write, report_tracking_flags_t report);
+typedef bool (*travel_limits_ptr)(float *target, axes_signals_t axes, bool is_cartesian);
+typedef void (*jog_limits_ptr)(float *target, float *position);
+typedef status_code_t (*sys_command_ptr)(sys_state_t state, char *args);
+
+typedef struct {
+    const char *command;
+    sys_command_ptr execute;
+    struct {
+        uint8_t noargs               :1,
+                allow_blocking       :1,
+                help_fully_described :1;
+    } flags;
+    struct {
+        const char *str;
+    } help;
+} sys_command_t;
+
+typedef struct sys_commands_str {
+    uint8_t n_commands;
+    const sys_command_t *commands;
+    struct sys_commands_str *(*on_get_commands)(void);
+} sys_commands_t;
+
+typedef sys_commands_t *(*on_get_commands_ptr)(void);
+typedef void (*on_wco_changed_ptr)(void);
+typedef status_code_t (*tool_change_ptr)(parser_state_t *gc_state);
+typedef void (*on_state_change_ptr)(sys_state_t state);
+
+typedef struct {
+    user_mcode_ptrs_t user_mcode;
+    on_tool_changed_ptr on_tool_changed;
+    on_probe_toolsetter_ptr on_probe_toolsetter;
+    on_probe_start_ptr on_probe_start;
+    on_probe_completed_ptr on_probe_completed;
+    on_spindle_select_ptr on_spindle_select;
+    on_tool_selected_ptr on_tool_selected;
+    on_report_options_ptr on_report_options;
+    enqueue_realtime_command_ptr enqueue_realtime_command;
+    on_execute_realtime_ptr on_execute_realtime;
+    on_execute_realtime_ptr on_execute_delay;
+    on_realtime_report_ptr on_realtime_report;
+    travel_limits_ptr check_travel_limits;
+    jog_limits_ptr apply_jog_limits;
+    on_get_commands_ptr on_get_commands;
+    on_wco_changed_ptr on_wco_changed;
+    bool (*enqueue_gcode)(char *data);
+    on_state_change_ptr on_state_change;
+} grbl_t;
+
+extern grbl_t grbl;
+
+typedef enum {
+    Port_Analog,
+    Port_Digital
+} io_port_type_t;
+
+typedef enum {
+    Port_Input,
+    Port_Output
+} io_port_direction_t;
+
+typedef enum {
+    WaitMode_Immediate,
+    WaitMode_Rise,
+    WaitMode_Fall,
+    WaitMode_High,
+    WaitMode_Low
+} wait_mode_t;
+
+typedef enum {
+    IRQ_Mode_None = 0,
+    IRQ_Mode_Rising = 1,
+    IRQ_Mode_Falling = 2,
+    IRQ_Mode_Change = 3
+} pin_irq_mode_t;
+
+typedef void (*ioport_interrupt_callback_ptr)(uint8_t port, bool state);
+
+typedef struct {
+    uint8_t irq_mode;
+} pin_cap_t;
+
+typedef struct xbar xbar_t;
+typedef float (*xbar_get_value_ptr)(xbar_t *pin);
+
+struct xbar {
+    uint8_t id;
+    void *port;
+    uint_fast8_t pin;
+    pin_cap_t cap;
+    const char *description;
+    xbar_get_value_ptr get_value;
+};
+
+typedef enum {
+    NVS_TransferResult_OK,
+    NVS_TransferResult_Failed
+} nvs_transfer_result_t;
+
+typedef uint32_t nvs_address_t;
+
+typedef struct {
+    driver_reset_ptr driver_reset;
+    void (*delay_ms)(uint32_t ms, delay_callback_ptr callback);
+    uint32_t (*get_elapsed_ticks)(void);
+    uint32_t (*get_micros)(void);
+    void (*irq_enable)(void);
+    void (*irq_disable)(void);
+    struct {
+        probe_get_state_ptr get_state;
+        probe_configure_ptr configure;
+    } probe;
+    struct {
+        stepper_pulse_start_ptr pulse_start;
+    } stepper;
+    struct {
+        void (*enable)(bool on, axes_signals_t homing);
+    } limits;
+    struct {
+        uint8_t num_digital_in;
+        uint8_t num_digital_out;
+        int32_t (*wait_on_input)(io_port_type_t type, uint8_t port, wait_mode_t wait_mode, float timeout);
+        bool (*register_interrupt_handler)(uint8_t port, uint8_t irq_mode, ioport_interrupt_callback_ptr handler);
+        void (*set_pin_description)(io_port_type_t type, io_port_direction_t dir, uint8_t port, const char *description);
+        xbar_t *(*get_pin_info)(io_port_type_t type, io_port_direction_t dir, uint8_t port);
+    } port;
+    struct {
+        nvs_transfer_result_t (*memcpy_from_nvs)(uint8_t *dest, nvs_address_t source, uint32_t size, bool with_checksum);
+        nvs_transfer_result_t (*memcpy_to_nvs)(nvs_address_t dest, uint8_t *source, uint32_t size, bool with_checksum);
+    } nvs;
+    struct {
+        void (*write)(const char *s);
+        void (*write_n)(const uint8_t *s, uint16_t len);
+        uint16_t (*get_rx_buffer_count)(void);
+    } stream;
+    struct {
+        tool_change_ptr change;
+    } tool;
+} hal_t;
+
+extern hal_t hal;
+
+typedef struct {
+    float steps_per_mm;
+    float acceleration;
+    float max_rate;
+    float max_travel;
+} axis_settings_t;
+
+typedef struct {
+    struct {
+        uint8_t invert_probe_pin :1;
+    } probe;
+    struct {
+        struct {
+            uint8_t hard_enabled     :1,
+                    soft_enabled     :1,
+                    jog_soft_limited :1;
+        } flags;
+    } limits;
+    axis_settings_t axis[N_AXIS];
+    struct {
+        float feed_rate;
+        float seek_rate;
+        float pulloff_rate;
+        float probing_distance;
+        uint8_t mode;
+    } tool_change;
+} settings_t;
+
+extern settings_t settings;
+
+typedef struct {
+    int32_t position[N_AXIS];
+    int32_t probe_position[N_AXIS];
+    int32_t tlo_reference[N_AXIS];
+    axes_signals_t tlo_reference_set;
+    axes_signals_t homed;
+    struct {
+        uint8_t probe_succeeded :1;
+    } flags;
+    volatile uint8_t probing_state;
+} system_t;
+
+extern system_t sys;
+
+typedef enum {
+    CoordinateSystem_G54 = 0,
+    CoordinateSystem_G59_3 = 8,
+    N_CoordinateSystems
+} coord_system_id_t;
+
+typedef enum {
+    Setting_UserDefined_0 = 450,
+    Setting_UserDefined_1,
+    Setting_UserDefined_2,
+    Setting_UserDefined_3,
+    Setting_UserDefined_4,
+    Setting_UserDefined_5,
+    Setting_UserDefined_6,
+    Setting_UserDefined_7,
+    Setting_UserDefined_8,
+    Setting_UserDefined_9
+} setting_id_t;
+
+typedef enum {
+    Group_Root,
+    Group_Probing
+} setting_group_t;
+
+typedef enum {
+    Format_Bool,
+    Format_Bitfield,
+    Format_XBitfield,
+    Format_RadioButtons,
+    Format_AxisMask,
+    Format_Integer,
+    Format_Decimal,
+    Format_String,
+    Format_Password,
+    Format_IPv4,
+    Format_Int8,
+    Format_Int16
+} setting_datatype_t;
+
+typedef enum {
+    Setting_NonCore,
+    Setting_NonCoreFn,
+    Setting_IsExtended
+} setting_type_t;
+
+typedef struct {
+    setting_group_t parent;
+    setting_group_t id;
+    const char *name;
+} setting_group_detail_t;
+
+typedef struct {
+    setting_id_t id;
+    setting_group_t group;
+    const char *name;
+    const char *unit;
+    setting_datatype_t datatype;
+    const char *format;
+    const char *min_value;
+    const char *max_value;
+    setting_type_t type;
+    void *value;
+    void *get_value;
+    void *is_available;
+} setting_detail_t;
+
+typedef struct {
+    setting_id_t id;
+    const char *description;
+} setting_descr_t;
+
+typedef struct {
+    const setting_group_detail_t *groups;
+    uint8_t n_groups;
+    const setting_detail_t *settings;
+    uint8_t n_settings;
+    const setting_descr_t *descriptions;
+    uint8_t n_descriptions;
+    void (*save)(void);
+    void (*load)(void);
+    void (*restore)(void);
+} setting_details_t;
+
+void settings_register (setting_details_t *details);
+const setting_detail_t *setting_get_details (setting_id_t id, setting_details_t **set);
+bool settings_read_coord_data (coord_system_id_t id, float (*coord_data)[N_AXIS]);
+bool settings_write_coord_data (coord_system_id_t id, float (*coord_data)[N_AXIS]);
+void system_flag_wco_change (void);
+void report_message (const char *msg, message_type_t type);
+bool task_add_immediate (foreground_task_ptr fn, void *data);
+bool ioport_claim (io_port_type_t type, io_port_direction_t dir, uint8_t *port, const char *description);
+bool ioport_can_claim_explicit (void);
+uint8_t ioports_available (io_port_type_t type, io_port_direction_t dir);
+nvs_address_t nvs_alloc (size_t size);
+char *uitoa (uint32_t n);
+char *ftoa (float n, uint8_t decimal_places);
+sys_state_t state_get (void);
+gc_probe_t mc_probe_cycle (float *target, plan_line_data_t *pl_data, gc_parser_flags_t parser_flags);
+bool mc_line (float *target, plan_line_data_t *pl_data);
+void plan_data_init (plan_line_data_t *plan_data);
+bool protocol_buffer_synchronize (void);
+bool protocol_execute_realtime (void);
+void system_convert_array_steps_to_mpos (float *position, int32_t *steps);
+void report_probe_parameters (void);
@@ -0,0 +1,3 @@
+// Host build stub, declarations are in hal.h.
+#pragma once
+#include "hal.h"
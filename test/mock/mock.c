@@ -0,0 +1,560 @@
+/*
+
+  mock.c - host build stub
+
+  Mock grblHAL core for host builds of the probe plugin. Motion is simulated one step at a time
+  so the step pulse hook sees every step, probe moves stop mock.overtravel_steps after a trigger.
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "mock.h"
+
+#define MOCK_NVS_SIZE 4096
+#define MOCK_TASKS 16
+
+hal_t hal;
+grbl_t grbl;
+settings_t settings;
+system_t sys;
+parser_state_t gc_state;
+mock_t mock;
+spindle_ptrs_t mock_spindle;
+setting_details_t *mock_settings = NULL;
+
+static uint8_t nvs[MOCK_NVS_SIZE];
+static bool nvs_written[MOCK_NVS_SIZE];
+static nvs_address_t nvs_next;
+static float coord_data[N_CoordinateSystems + 1][N_AXIS];
+static stepper_t stepper;
+static struct {
+    foreground_task_ptr fn;
+    void *data;
+} tasks[MOCK_TASKS];
+static uint_fast8_t n_tasks;
+
+static uint32_t get_elapsed_ticks (void)
+{
+    return mock.ms;
+}
+
+static void irq_enable (void)
+{
+}
+
+static void irq_disable (void)
+{
+}
+
+static uint32_t get_micros (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t)(ts.tv_sec * 1000000UL + ts.tv_nsec / 1000);
+}
+
+static void delay_ms (uint32_t ms, delay_callback_ptr callback)
+{
+    mock.ms += ms;
+
+    if(callback)
+        callback();
+}
+
+static probe_state_t probe_get_state (void)
+{
+    probe_state_t state = {0};
+
+    state.connected = mock.probe_connected;
+    state.triggered = mock.probe_level != settings.probe.invert_probe_pin;
+
+    return state;
+}
+
+static void pulse_start (stepper_t *stepper)
+{
+    mock.pulses++;
+}
+
+static void limits_enable (bool on, axes_signals_t homing)
+{
+}
+
+static int32_t wait_on_input (io_port_type_t type, uint8_t port, wait_mode_t wait_mode, float timeout)
+{
+    return port < MOCK_PORTS ? mock.port[port] : -1;
+}
+
+static bool register_interrupt_handler (uint8_t port, uint8_t irq_mode, ioport_interrupt_callback_ptr handler)
+{
+    if(port >= MOCK_PORTS || !mock.irq_capable)
+        return false;
+
+    mock.irq[port] = irq_mode == IRQ_Mode_None ? NULL : handler;
+
+    return true;
+}
+
+static nvs_transfer_result_t memcpy_from_nvs (uint8_t *dest, nvs_address_t source, uint32_t size, bool with_checksum)
+{
+    uint32_t idx;
+
+    if(source + size > MOCK_NVS_SIZE)
+        return NVS_TransferResult_Failed;
+
+    //a checksummed block fails until it has been written in full, as the checksum would not match.
+    for(idx = 0; with_checksum && idx < size; idx++) {
+        if(!nvs_written[source + idx])
+            return NVS_TransferResult_Failed;
+    }
+
+    memcpy(dest, &nvs[source], size);
+
+    return NVS_TransferResult_OK;
+}
+
+static nvs_transfer_result_t memcpy_to_nvs (nvs_address_t dest, uint8_t *source, uint32_t size, bool with_checksum)
+{
+    if(dest + size > MOCK_NVS_SIZE)
+        return NVS_TransferResult_Failed;
+
+    memcpy(&nvs[dest], source, size);
+    memset(&nvs_written[dest], true, size);
+
+    return NVS_TransferResult_OK;
+}
+
+static uint16_t stream_get_rx_buffer_count (void)
+{
+    return mock.rx_count;
+}
+
+static void stream_write_n (const uint8_t *s, uint16_t len)
+{
+    if(len > MOCK_OUTPUT - 1 - mock.output_len)
+        len = MOCK_OUTPUT - 1 - mock.output_len;
+
+    memcpy(&mock.output[mock.output_len], s, len);
+    mock.output_len += len;
+    mock.output[mock.output_len] = '\0';
+}
+
+static void stream_write (const char *s)
+{
+    stream_write_n((const uint8_t *)s, strlen(s));
+}
+
+static void driver_reset (void)
+{
+}
+
+static bool enqueue_realtime_command (char c)
+{
+    if(c == CMD_STOP)
+        mock.cmd_stop++;
+    else if((uint8_t)c == CMD_PROBE_CONNECTED_TOGGLE)
+        mock.cmd_toggle++;
+
+    return true;
+}
+
+static bool enqueue_gcode (char *data)
+{
+    strncpy(mock.gcode[mock.gcode_lines++ % MOCK_GCODE_LINES], data, sizeof(mock.gcode[0]) - 1);
+
+    return true;
+}
+
+static void probe_configure (bool is_probe_away, bool probing)
+{
+    mock.probe_armed = probing;
+}
+
+static void on_execute_realtime (uint_fast16_t state)
+{
+}
+
+static void on_report_options (bool newopt)
+{
+}
+
+static bool check_travel_limits (float *target, axes_signals_t axes, bool is_cartesian)
+{
+    return true;
+}
+
+static void apply_jog_limits (float *target, float *position)
+{
+}
+
+static void spindle_set_state (spindle_ptrs_t *spindle, spindle_state_t state, float rpm)
+{
+    mock.spindle = state;
+}
+
+// Resets the core to power up state with an empty NVS, call before probe_protect_init().
+void mock_init (void)
+{
+    uint_fast8_t idx;
+
+    memset(&hal, 0, sizeof(hal_t));
+    memset(&grbl, 0, sizeof(grbl_t));
+    memset(&settings, 0, sizeof(settings_t));
+    memset(&sys, 0, sizeof(system_t));
+    memset(&gc_state, 0, sizeof(parser_state_t));
+    memset(&mock, 0, sizeof(mock_t));
+    memset(nvs, 0xFF, sizeof(nvs));
+    memset(nvs_written, 0, sizeof(nvs_written));
+    memset(coord_data, 0, sizeof(coord_data));
+    nvs_next = 0;
+    n_tasks = 0;
+
+    mock.ms = 1000;
+    mock.probe_connected = true;
+    mock.contact_port = MOCK_PORTS;
+    mock.contact_z = MOCK_NO_CONTACT;
+    mock.overtravel_steps = 10;
+
+    for(idx = 0; idx < N_AXIS; idx++) {
+        settings.axis[idx].steps_per_mm = 100.0f;
+        settings.axis[idx].acceleration = 100.0f * 3600.0f;
+        settings.axis[idx].max_rate = 5000.0f;
+        settings.axis[idx].max_travel = -200.0f;
+    }
+
+    hal.driver_reset = driver_reset;
+    hal.delay_ms = delay_ms;
+    hal.get_elapsed_ticks = get_elapsed_ticks;
+    hal.get_micros = get_micros;
+    hal.irq_enable = irq_enable;
+    hal.irq_disable = irq_disable;
+    hal.probe.get_state = probe_get_state;
+    hal.probe.configure = probe_configure;
+    hal.stepper.pulse_start = pulse_start;
+    hal.limits.enable = limits_enable;
+    hal.port.num_digital_in = hal.port.num_digital_out = MOCK_PORTS;
+    hal.port.wait_on_input = wait_on_input;
+    hal.port.register_interrupt_handler = register_interrupt_handler;
+    hal.nvs.memcpy_from_nvs = memcpy_from_nvs;
+    hal.nvs.memcpy_to_nvs = memcpy_to_nvs;
+    hal.stream.write = stream_write;
+    hal.stream.write_n = stream_write_n;
+    hal.stream.get_rx_buffer_count = stream_get_rx_buffer_count;
+
+    grbl.enqueue_realtime_command = enqueue_realtime_command;
+    grbl.enqueue_gcode = enqueue_gcode;
+    grbl.on_execute_realtime = on_execute_realtime;
+    grbl.on_report_options = on_report_options;
+    grbl.check_travel_limits = check_travel_limits;
+    grbl.apply_jog_limits = apply_jog_limits;
+
+    mock_spindle.set_state = spindle_set_state;
+}
+
+// Runs the foreground tasks queued by task_add_immediate().
+void mock_run_tasks (void)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < n_tasks; idx++)
+        tasks[idx].fn(tasks[idx].data);
+
+    n_tasks = 0;
+}
+
+// Advances the time by ms and runs the realtime loop once.
+void mock_realtime (uint32_t ms)
+{
+    mock.ms += ms;
+    grbl.on_execute_realtime(mock.state);
+    mock_run_tasks();
+}
+
+void mock_state_set (sys_state_t state)
+{
+    mock.state = state;
+
+    if(grbl.on_state_change)
+        grbl.on_state_change(state);
+}
+
+bool mock_message_seen (const char *msg)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < MOCK_MESSAGES && idx < mock.messages; idx++) {
+        if(strstr(mock.message[idx], msg))
+            return true;
+    }
+
+    return false;
+}
+
+// Step pulse as output by the stepper ISR.
+void mock_step_pulse (void)
+{
+    if(hal.stepper.pulse_start)
+        hal.stepper.pulse_start(&stepper);
+}
+
+static void contact_update (void)
+{
+    bool contact = sys.position[Z_AXIS] <= mock.contact_z;
+
+    if(mock.contact_port < MOCK_PORTS)
+        mock.port[mock.contact_port] = contact;
+    else
+        mock.probe_level = contact;
+}
+
+// Moves one step per axis toward target each pulse until reached or stop returns true.
+static bool move_steps (const float *target, bool (*stop)(void))
+{
+    uint_fast8_t idx;
+    bool moving;
+    int32_t steps[N_AXIS];
+
+    for(idx = 0; idx < N_AXIS; idx++)
+        steps[idx] = (int32_t)lroundf(target[idx] * settings.axis[idx].steps_per_mm);
+
+    do {
+        moving = false;
+        for(idx = 0; idx < N_AXIS; idx++) {
+            if(sys.position[idx] != steps[idx]) {
+                sys.position[idx] += sys.position[idx] < steps[idx] ? 1 : -1;
+                moving = true;
+            }
+        }
+        if(moving) {
+            contact_update();
+            mock_step_pulse();
+        }
+    } while(moving && !(stop && stop()));
+
+    return !moving;
+}
+
+static int32_t overtravel;
+static float queued[N_AXIS];    // move planned while the probe is armed, runs ahead of the probe move
+static bool queued_valid = false;
+
+static bool probe_stop (void)
+{
+    if(overtravel < 0 && hal.probe.get_state().triggered) {
+        memcpy(sys.probe_position, sys.position, sizeof(sys.probe_position));
+        sys.flags.probe_succeeded = On;
+        overtravel = mock.overtravel_steps;
+    }
+
+    return overtravel >= 0 && overtravel-- == 0;
+}
+
+void settings_register (setting_details_t *details)
+{
+    mock_settings = details;
+}
+
+const setting_detail_t *setting_get_details (setting_id_t id, setting_details_t **set)
+{
+    static const setting_detail_t taken = {0};
+
+    return mock.taken_setting && id == mock.taken_setting ? &taken : NULL;
+}
+
+bool settings_read_coord_data (coord_system_id_t id, float (*data)[N_AXIS])
+{
+    memcpy(data, coord_data[id], sizeof(coord_data[0]));
+
+    return true;
+}
+
+bool settings_write_coord_data (coord_system_id_t id, float (*data)[N_AXIS])
+{
+    memcpy(coord_data[id], data, sizeof(coord_data[0]));
+
+    return true;
+}
+
+void system_flag_wco_change (void)
+{
+    if(grbl.on_wco_changed)
+        grbl.on_wco_changed();
+}
+
+void report_message (const char *msg, message_type_t type)
+{
+    strncpy(mock.message[mock.messages++ % MOCK_MESSAGES], msg, sizeof(mock.message[0]) - 1);
+}
+
+bool task_add_immediate (foreground_task_ptr fn, void *data)
+{
+    if(n_tasks == MOCK_TASKS)
+        return false;
+
+    tasks[n_tasks].fn = fn;
+    tasks[n_tasks++].data = data;
+
+    return true;
+}
+
+bool ioport_claim (io_port_type_t type, io_port_direction_t dir, uint8_t *port, const char *description)
+{
+    return *port < MOCK_PORTS;
+}
+
+bool ioport_can_claim_explicit (void)
+{
+    return true;
+}
+
+uint8_t ioports_available (io_port_type_t type, io_port_direction_t dir)
+{
+    return MOCK_PORTS;
+}
+
+nvs_address_t nvs_alloc (size_t size)
+{
+    nvs_address_t address;
+
+    if(nvs_next + size > MOCK_NVS_SIZE)
+        return 0;
+
+    address = nvs_next + 1; // 0 is reserved for allocation failure
+    nvs_next += size + 1;
+
+    return address;
+}
+
+char *uitoa (uint32_t n)
+{
+    static char buf[12];
+
+    snprintf(buf, sizeof(buf), "%u", (unsigned)n);
+
+    return buf;
+}
+
+char *ftoa (float n, uint8_t decimal_places)
+{
+    static char buf[20];
+
+    snprintf(buf, sizeof(buf), "%.*f", decimal_places, (double)n);
+
+    return buf;
+}
+
+sys_state_t state_get (void)
+{
+    return mock.state;
+}
+
+gc_probe_t mc_probe_cycle (float *target, plan_line_data_t *pl_data, gc_parser_flags_t parser_flags)
+{
+    uint_fast8_t idx;
+    axes_signals_t axes = {0};
+    float position[N_AXIS];
+
+    system_convert_array_steps_to_mpos(position, sys.position);
+
+    for(idx = 0; idx < N_AXIS; idx++) {
+        if(target[idx] != position[idx])
+            axes.mask |= bit(idx);
+    }
+
+    if(grbl.on_probe_start && !grbl.on_probe_start(axes, target, pl_data))
+        return GCProbe_Abort;
+
+    if(mock.state == STATE_CHECK_MODE)
+        return GCProbe_CheckMode;
+
+    sys.flags.probe_succeeded = Off;
+    hal.probe.configure(parser_flags.probe_is_away, true);
+    overtravel = -1;
+    contact_update();
+
+    if(hal.probe.get_state().triggered) {
+        hal.probe.configure(false, false);
+        return GCProbe_FailInit;
+    }
+
+    // the probe move is planned, then executed while the core waits in the realtime loop.
+    mock.probe_moves++;
+    mock.probe_feed = pl_data->feed_rate;
+    for(idx = 0; idx < N_AXIS; idx++)
+        mock.probe_accel[idx] = settings.axis[idx].acceleration;
+    protocol_execute_realtime();
+    if(!queued_valid || move_steps(queued, probe_stop))
+        move_steps(target, probe_stop);
+    queued_valid = false;
+    contact_update();
+
+    hal.probe.configure(false, false);
+
+    if(grbl.on_probe_completed)
+        grbl.on_probe_completed();
+
+    return sys.flags.probe_succeeded ? GCProbe_Found : GCProbe_FailEnd;
+}
+
+bool mc_line (float *target, plan_line_data_t *pl_data)
+{
+    axes_signals_t axes = { .mask = bit(N_AXIS) - 1 };
+
+    if(!grbl.check_travel_limits(target, axes, true))
+        return false;
+
+    mock.move_feed = pl_data->condition.rapid_motion ? 0.0f : pl_data->feed_rate;
+
+    // planned ahead of the probe move, executed with it under probe monitoring.
+    if(mock.probe_armed) {
+        memcpy(queued, target, sizeof(queued));
+        return (queued_valid = true);
+    }
+
+    return move_steps(target, NULL);
+}
+
+void plan_data_init (plan_line_data_t *plan_data)
+{
+    memset(plan_data, 0, sizeof(plan_line_data_t));
+    plan_data->rate_multiplier = 1.0f;
+}
+
+bool protocol_buffer_synchronize (void)
+{
+    return true;
+}
+
+bool protocol_execute_realtime (void)
+{
+    mock_realtime(1);
+
+    return true;
+}
+
+void system_convert_array_steps_to_mpos (float *position, int32_t *steps)
+{
+    uint_fast8_t idx;
+
+    for(idx = 0; idx < N_AXIS; idx++)
+        position[idx] = (float)steps[idx] / settings.axis[idx].steps_per_mm;
+}
+
+void report_probe_parameters (void)
+{
+    uint_fast8_t idx;
+
+    hal.stream.write("[PRB:");
+    for(idx = 0; idx < N_AXIS; idx++) {
+        if(idx)
+            hal.stream.write(",");
+        hal.stream.write(ftoa((float)sys.probe_position[idx] / settings.axis[idx].steps_per_mm, 3));
+    }
+    hal.stream.write(sys.flags.probe_succeeded ? ":1]" ASCII_EOL : ":0]" ASCII_EOL);
+}
@@ -0,0 +1,61 @@
+/*
+
+  mock.h - host build stub
+
+  State of the mock grblHAL core used by the probe plugin tests. Inputs are driven by the test,
+  outputs record what the plugin did.
+
+*/
+
+#pragma once
+
+#include "grbl/hal.h"
+
+#define MOCK_PORTS 8
+#define MOCK_MESSAGES 16
+#define MOCK_GCODE_LINES 16
+#define MOCK_OUTPUT 4096
+#define MOCK_NO_CONTACT INT32_MIN
+
+typedef struct {
+    // inputs
+    uint32_t ms;                        // hal.get_elapsed_ticks()
+    sys_state_t state;                  // state_get()
+    bool probe_level;                   // core probe input, before inversion
+    bool probe_connected;               // core probe connected state
+    bool port[MOCK_PORTS];              // aux digital inputs
+    bool irq_capable;                   // aux inputs accept interrupt handlers
+    uint8_t contact_port;               // input driven by the simulated contact, MOCK_PORTS - core probe input
+    int32_t contact_z;                  // Z step position at or below which the probe is in contact
+    int32_t overtravel_steps;           // steps moved after a trigger before the machine stops
+    uint16_t rx_count;                  // characters in the stream input buffer
+    uint16_t taken_setting;             // setting id already registered by another plugin, 0 - none
+    // outputs
+    uint32_t pulses;                    // calls of the driver step pulse handler
+    uint32_t cmd_stop;                  // CMD_STOP realtime commands enqueued
+    uint32_t cmd_toggle;                // CMD_PROBE_CONNECTED_TOGGLE realtime commands enqueued
+    spindle_state_t spindle;            // last state passed to the driver spindle
+    uint32_t messages;                  // total messages reported
+    char message[MOCK_MESSAGES][80];    // last messages, ring
+    uint32_t gcode_lines;               // total lines enqueued by grbl.enqueue_gcode
+    char gcode[MOCK_GCODE_LINES][100];  // last lines, ring
+    uint32_t probe_moves;               // probe moves executed by mc_probe_cycle
+    float probe_feed;                   // feed rate of the last probe move
+    float probe_accel[N_AXIS];          // axis accelerations when the last probe move was planned
+    bool probe_armed;                   // last probing state passed to hal.probe.configure
+    float move_feed;                    // feed rate of the last mc_line move, 0 for rapids
+    uint16_t output_len;                // characters written to the stream, tests reset it
+    char output[MOCK_OUTPUT];           // stream output, binary records included
+    ioport_interrupt_callback_ptr irq[MOCK_PORTS];
+} mock_t;
+
+extern mock_t mock;
+extern spindle_ptrs_t mock_spindle;
+extern setting_details_t *mock_settings;
+
+void mock_init (void);
+void mock_run_tasks (void);
+void mock_realtime (uint32_t ms);
+void mock_state_set (sys_state_t state);
+bool mock_message_seen (const char *msg);
+void mock_step_pulse (void);
@@ -0,0 +1,1191 @@
+/*
+
+  probe_plugin_test.c - host build scenario tests and hook benchmarks
+
+  The plugin is compiled into the test so its internal state can be checked, the core is
+  provided by mock/mock.c. Each scenario runs in a child process on a freshly initialized plugin.
+
+  Usage: probe_plugin_test [bench]
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "mock.h"
+#include "../probe_plugin.c"
+
+#define BENCH_CALLS 1000000
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if(!(cond)) { \
+        printf("  %s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while(0)
+
+static void settings_apply (void)
+{
+    mock_settings->save();
+    mock_settings->load();
+    mock_run_tasks();
+}
+
+// Power up with motion protection enabled and the toolsetter on aux input 1.
+static void plugin_init (void)
+{
+    mock_init();
+    probe_protect_init();
+    mock_settings->load();
+    mock_run_tasks();
+
+    probe_protect_settings.flags.motion_protect = On;
+    probe_protect_settings.flags.tool_pin = On;
+    probe_protect_settings.tool_port = 1;
+    probe_protect_settings.options.tool_cache = On;
+    settings_apply();
+
+    grbl.on_spindle_select(&mock_spindle);
+}
+
+// External probe connected pin on aux input 2 with interrupt capable inputs.
+#define EXT_PIN_PORT 2
+
+static void ext_pin_setup (void)
+{
+    mock.irq_capable = true;
+    probe_protect_settings.flags.ext_pin = On;
+    probe_protect_settings.protect_port = EXT_PIN_PORT;
+    settings_apply();
+}
+
+// Changes the pin level and runs the realtime loop until the change is confirmed.
+static void ext_pin_set (bool level)
+{
+    mock.port[EXT_PIN_PORT] = level;
+    if(mock.irq[EXT_PIN_PORT])
+        mock.irq[EXT_PIN_PORT](EXT_PIN_PORT, level);
+    mock_realtime(probe_protect_settings.connect_debounce);
+}
+
+static status_code_t mcode (user_mcode_t code, parser_block_t *block)
+{
+    status_code_t status;
+    parser_block_t empty = {0};
+
+    if(block == NULL)
+        block = &empty;
+
+    block->user_mcode = code;
+
+    if(grbl.user_mcode.check(code) == UserMCode_Unsupported)
+        return Status_GcodeUnsupportedCommand;
+
+    if((status = grbl.user_mcode.validate(block)) == Status_OK)
+        grbl.user_mcode.execute(mock.state, block);
+
+    return status;
+}
+
+static void tool_select (tool_data_t *tool, uint32_t tool_id)
+{
+    tool->tool_id = tool_id;
+    grbl.on_tool_selected(tool);
+}
+
+static void spindle_set (bool on)
+{
+    spindle_state_t state = {0};
+
+    state.on = on;
+    mock_spindle.set_state(&mock_spindle, state, on ? 10000.0f : 0.0f);
+}
+
+static gc_probe_t probe_z (float z, float feed_rate)
+{
+    float target[N_AXIS];
+    plan_line_data_t plan_data;
+    gc_parser_flags_t flags = {0};
+
+    system_convert_array_steps_to_mpos(target, sys.position);
+    target[Z_AXIS] = z;
+    plan_data_init(&plan_data);
+    plan_data.feed_rate = feed_rate;
+
+    return mc_probe_cycle(target, &plan_data, flags);
+}
+
+static bool move_to (float x, float y, float z)
+{
+    float target[N_AXIS] = { x, y, z };
+    plan_line_data_t plan_data;
+
+    plan_data_init(&plan_data);
+    plan_data.condition.rapid_motion = On;
+
+    return mc_line(target, &plan_data);
+}
+
+// Reads a little endian 32 bit value from a binary record.
+static int32_t record_int32 (const char *p)
+{
+    const uint8_t *b = (const uint8_t *)p;
+
+    return (int32_t)((uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24));
+}
+
+// CRC-8 as documented for the binary records: polynomial 0x07, initial value 0xFF, not reflected.
+static uint8_t record_crc (const char *p, uint_fast8_t size)
+{
+    uint_fast8_t bit;
+    uint8_t crc = 0xFF;
+
+    while(size--) {
+        crc ^= (uint8_t)*p++;
+        for(bit = 0; bit < 8; bit++)
+            crc = crc & 0x80 ? (crc << 1) ^ 0x07 : crc << 1;
+    }
+
+    return crc;
+}
+
+static void scenario_m401_m402 (void)
+{
+    stepper_pulse_start_ptr driver_pulse_start = hal.stepper.pulse_start;
+
+    CHECK(grbl.user_mcode.check(401) == UserMCode_Normal);
+    CHECK(grbl.user_mcode.check(499) == UserMCode_Unsupported);
+
+    CHECK(mcode(401, NULL) == Status_OK);
+    CHECK(probe_connected.mcode);
+    CHECK(protection_enabled);
+    CHECK(hal.stepper.pulse_start == on_pulse_start);
+
+    mock_realtime(CONNECTED_REPORT_INTERVAL);
+    CHECK(mock_message_seen("Probe connected:M"));
+
+    // steps with the probe at rest are passed on to the driver.
+    mock_step_pulse();
+    mock_step_pulse();
+    CHECK(mock.pulses == 2);
+    mock_realtime(PROBE_DEBOUNCE);
+    CHECK(mock.cmd_stop == 0);
+
+    // a probe trigger confirmed after the debounce window stops the machine.
+    mock.probe_level = true;
+    mock_step_pulse();
+    mock_realtime(1);
+    CHECK(mock.cmd_stop == 0);
+    mock_realtime(PROBE_DEBOUNCE);
+    CHECK(mock.cmd_stop == 1);
+
+    // a glitch shorter than the window does not.
+    mock.probe_level = false;
+    mock_step_pulse();
+    mock_realtime(PROBE_DEBOUNCE);
+    mock.probe_level = true;
+    mock_step_pulse();
+    mock.probe_level = false;
+    mock_step_pulse();
+    mock_realtime(PROBE_DEBOUNCE);
+    CHECK(mock.cmd_stop == 1);
+
+    CHECK(mcode(401, NULL) == Status_OK);
+    CHECK(mock_message_seen("already asserted"));
+
+    CHECK(mcode(402, NULL) == Status_OK);
+    CHECK(!probe_connected.mcode);
+    CHECK(!protection_enabled);
+    CHECK(hal.stepper.pulse_start == driver_pulse_start);
+
+    mock_realtime(CONNECTED_REPORT_INTERVAL);
+    CHECK(mock_message_seen("Probe disconnected"));
+
+    CHECK(mcode(402, NULL) == Status_OK);
+    CHECK(mock_message_seen("not asserted"));
+}
+
+// Aux input 3 wired in parallel with the probe, edges are handled by interrupt instead of the step pulse hook.
+#define PROTECT_IRQ_PORT 3
+
+static void scenario_protect_irq (void)
+{
+    stepper_pulse_start_ptr driver_pulse_start = hal.stepper.pulse_start;
+
+    mock.irq_capable = true;
+    probe_protect_settings.flags.protect_irq = On;
+    probe_protect_settings.protect_irq_port = PROTECT_IRQ_PORT;
+    settings_apply();
+    CHECK(protect_irq_ok);
+    CHECK(mock.irq[PROTECT_IRQ_PORT] == NULL);
+
+    CHECK(mcode(401, NULL) == Status_OK);
+    CHECK(protection_enabled);
+    CHECK(mock.irq[PROTECT_IRQ_PORT] == on_probe_edge);
+    CHECK(hal.stepper.pulse_start == driver_pulse_start);
+
+    mock_realtime(PROBE_DEBOUNCE);
+    CHECK(mock.cmd_stop == 0);
+
+    // a trigger confirmed after the debounce window stops the machine once.
+    mock.probe_level = mock.port[PROTECT_IRQ_PORT] = true;
+    mock.irq[PROTECT_IRQ_PORT](PROTECT_IRQ_PORT, true);
+    mock_realtime(1);
+    CHECK(mock.cmd_stop == 0);
+    mock_realtime(PROBE_DEBOUNCE);
+    CHECK(mock.cmd_stop == 1);
+    mock.irq[PROTECT_IRQ_PORT](PROTECT_IRQ_PORT, true);
+    mock_realtime(PROBE_DEBOUNCE * 2);
+    CHECK(mock.cmd_stop == 1);
+
+    mock.probe_level = mock.port[PROTECT_IRQ_PORT] = false;
+    mock.irq[PROTECT_IRQ_PORT](PROTECT_IRQ_PORT, false);
+    mock_realtime(PROBE_DEBOUNCE);
+
+    // disconnecting disarms the interrupt.
+    CHECK(mcode(402, NULL) == Status_OK);
+    CHECK(!protection_enabled);
+    CHECK(mock.irq[PROTECT_IRQ_PORT] == NULL);
+    CHECK(hal.stepper.pulse_start == driver_pulse_start);
+}
+
+static void scenario_t99 (void)
+{
+    tool_data_t tool = {0};
+
+    tool_select(&tool, 99);
+    CHECK(probe_connected.t99);
+    CHECK(protection_enabled);
+    CHECK(current_tool == &tool);
+
+    tool_select(&tool, 1);
+    CHECK(!probe_connected.t99);
+    CHECK(!protection_enabled);
+
+    probe_protect_settings.flags.t99_protect = Off;
+    settings_apply();
+
+    tool_select(&tool, 99);
+    CHECK(!probe_connected.value);
+    CHECK(!protection_enabled);
+}
+
+static void scenario_tool_probe (void)
+{
+    tool_data_t tool = {0};
+    parser_block_t block = {0};
+
+    tool_select(&tool, 5);
+    mock.probe_level = true; // touch probe deflected, must be ignored while probing at the toolsetter.
+    mock.contact_port = probe_protect_settings.tool_port;
+    mock.contact_z = -1000;
+
+    CHECK(grbl.on_probe_toolsetter(&tool, NULL, true, true));
+    CHECK(probe_selected == ProbeSource_Toolsetter);
+    CHECK(fixture_active);
+
+    CHECK(probe_z(-20.0f, 100.0f) == GCProbe_Found);
+    CHECK(sys.probe_position[Z_AXIS] == -1000);
+    CHECK(sys.position[Z_AXIS] == -1000 - mock.overtravel_steps);
+    CHECK(latch.valid && latch.source == ProbeSource_Toolsetter);
+    CHECK(fabsf(latch.overtravel - (float)mock.overtravel_steps / settings.axis[Z_AXIS].steps_per_mm) < 1e-4f);
+
+    CHECK(grbl.on_probe_toolsetter(&tool, NULL, true, false));
+    CHECK(probe_selected == ProbeSource_Touch);
+    CHECK(!fixture_active);
+
+    CHECK(tool_cache_get(5) != NULL && tool_cache_get(5)->contact == -10.0f);
+
+    // M404 P<tool> drops one tool, M404 all of them.
+    tool_cache_set(tool_cache_slot(6), 6, -12.0f);
+    block.words.p = On;
+    block.values.p = 5.0f;
+    CHECK(mcode(404, &block) == Status_OK);
+    CHECK(tool_cache_get(5) == NULL && tool_cache_get(6) != NULL);
+    CHECK(mcode(404, NULL) == Status_OK);
+    CHECK(tool_cache_get(6) == NULL);
+}
+
+static void scenario_m407_select (void)
+{
+    tool_data_t tool = {0};
+    parser_block_t block = {0};
+
+    // P selects a source regardless of the tool, M407 returns to automatic selection.
+    tool_select(&tool, 5);
+    block.words.p = On;
+    block.values.p = (float)ProbeSource_Toolsetter;
+    CHECK(mcode(407, &block) == Status_OK);
+    CHECK(probe_manual && probe_selected == ProbeSource_Toolsetter);
+    tool_select(&tool, 6);
+    CHECK(probe_selected == ProbeSource_Toolsetter);
+
+    CHECK(mcode(407, NULL) == Status_OK);
+    CHECK(!probe_manual && probe_selected == ProbeSource_Touch);
+
+    block.words.p = On;
+    block.values.p = (float)ProbeSource_Wireless; // not enabled
+    CHECK(mcode(407, &block) == Status_GcodeValueOutOfRange);
+}
+
+static void scenario_cache_approach (void)
+{
+    tool_data_t tool = {0};
+
+    settings.tool_change.seek_rate = 500.0f;
+    probe_protect_settings.cache_clearance = 2.0f;
+    settings_apply();
+
+    tool_select(&tool, 5);
+    mock.contact_port = probe_protect_settings.tool_port;
+    mock.contact_z = -1000;
+
+    CHECK(grbl.on_probe_toolsetter(&tool, NULL, true, true));
+    CHECK(probe_z(-20.0f, 100.0f) == GCProbe_Found);
+    CHECK(grbl.on_probe_toolsetter(&tool, NULL, true, false));
+    CHECK(tool_cache_get(5) != NULL && tool_cache_get(5)->contact == -10.0f);
+    CHECK(move_to(0.0f, 0.0f, 0.0f));
+
+    // no motion is issued from on_probe_start.
+    mock.move_feed = 0.0f;
+    CHECK(grbl.on_probe_toolsetter(&tool, NULL, true, true));
+    mock.state = STATE_CHECK_MODE;
+    CHECK(probe_z(-20.0f, 100.0f) == GCProbe_CheckMode);
+    mock.state = STATE_IDLE;
+    CHECK(sys.position[Z_AXIS] == 0 && mock.move_feed == 0.0f);
+
+    // same length: the approach ends at the clearance above the cached contact, the probe move verifies.
+    CHECK(probe_z(-20.0f, 100.0f) == GCProbe_Found);
+    CHECK(mock.move_feed == 500.0f);
+    CHECK(sys.probe_position[Z_AXIS] == -1000);
+    CHECK(grbl.on_probe_toolsetter(&tool, NULL, true, false));
+    CHECK(move_to(0.0f, 0.0f, 0.0f));
+
+    // re-chucked 5mm longer: the approach stops on contact instead of driving into the toolsetter.
+    mock.contact_z = -500;
+    CHECK(grbl.on_probe_toolsetter(&tool, NULL, true, true));
+    CHECK(probe_z(-20.0f, 100.0f) == GCProbe_Found);
+    CHECK(sys.probe_position[Z_AXIS] == -500);
+    CHECK(sys.position[Z_AXIS] == -500 - mock.overtravel_steps);
+    CHECK(grbl.on_probe_toolsetter(&tool, NULL, true, false));
+    CHECK(tool_cache_get(5) != NULL && tool_cache_get(5)->contact == -5.0f);
+}
+
+static void scenario_spindle_connected (void)
+{
+    spindle_set(true);
+    CHECK(mock.spindle.on);
+    CHECK(mock.cmd_stop == 0);
+    spindle_set(false);
+
+    CHECK(mcode(401, NULL) == Status_OK);
+
+    spindle_set(true);
+    CHECK(!mock.spindle.on);
+    CHECK(mock.cmd_stop == 1);
+    mock_realtime(1);
+    CHECK(mock_message_seen("PROBE IS IN SPINDLE!"));
+
+    CHECK(mcode(402, NULL) == Status_OK);
+
+    spindle_set(true);
+    CHECK(mock.spindle.on);
+    CHECK(mock.cmd_stop == 1);
+}
+
+static void m403_block (parser_block_t *block)
+{
+    memset(block, 0, sizeof(parser_block_t));
+    block->words.k = block->words.p = block->words.q = block->words.r = block->words.l = On;
+    block->values.ijk[Z_AXIS] = -20.0f;
+    block->values.p = 300.0f;
+    block->values.q = 20.0f;
+    block->values.r = 1.0f;
+    block->values.l = 3;
+}
+
+static void scenario_m403_two_stage (void)
+{
+    parser_block_t block;
+
+    // seek, then back off 1mm and probe three times at the slow feed, the result is the mean trigger position.
+    mock.contact_z = -500;
+    m403_block(&block);
+    CHECK(mcode(403, &block) == Status_OK);
+    CHECK(mock.probe_moves == 4);
+    CHECK(mock.probe_feed == 20.0f);
+    CHECK(sys.flags.probe_succeeded);
+    CHECK(sys.probe_position[Z_AXIS] == -500);
+    CHECK(sys.position[Z_AXIS] == -400);
+    CHECK(strstr(mock.output, "[PRB:0.000,0.000,-5.000:1]") != NULL);
+    CHECK(!cycle_active);
+
+    // no contact within the seek distance, nothing is reported.
+    move_to(0.0f, 0.0f, 0.0f);
+    mock.contact_z = MOCK_NO_CONTACT;
+    mock.output_len = 0;
+    mock.probe_moves = 0;
+    m403_block(&block);
+    CHECK(mcode(403, &block) == Status_OK);
+    CHECK(mock.probe_moves == 1);
+    CHECK(!sys.flags.probe_succeeded);
+    CHECK(mock.output_len == 0);
+    CHECK(!cycle_active);
+
+    m403_block(&block);
+    block.words.p = Off;
+    CHECK(mcode(403, &block) == Status_GcodeValueWordMissing);
+    m403_block(&block);
+    block.values.l = 0;
+    CHECK(mcode(403, &block) == Status_GcodeValueOutOfRange);
+    m403_block(&block);
+    block.values.ijk[Z_AXIS] = 0.0f;
+    CHECK(mcode(403, &block) == Status_GcodeValueOutOfRange);
+}
+
+static void scenario_m405_map (void)
+{
+    parser_block_t block = {0};
+
+    mock.contact_z = -50;
+
+    block.words.i = block.words.j = block.words.k = block.words.p = block.words.q = On;
+    block.values.ijk[X_AXIS] = 2.0f;
+    block.values.ijk[Y_AXIS] = 3.0f;
+    block.values.ijk[Z_AXIS] = 1.0f; // probe depth, the parser puts K in ijk[].
+    block.values.p = 3.0f;
+    block.values.q = 2.0f;
+    block.values.f = 100.0f;
+
+    CHECK(mcode(405, &block) == Status_OK);
+    CHECK(probe_map.probed == 6);
+    CHECK(probe_map.z[5] == -500);
+    CHECK(sys.position[X_AXIS] == 0 && sys.position[Y_AXIS] == 300 && sys.position[Z_AXIS] == 0);
+
+    block.words.i = block.words.j = block.words.k = block.words.p = block.words.q = On;
+    block.values.ijk[Z_AXIS] = 0.0f;
+    CHECK(mcode(405, &block) == Status_GcodeValueOutOfRange);
+}
+
+static void scenario_m406_repeatability (void)
+{
+    parser_block_t block = {0};
+
+    // a seek followed by five probes from 1mm back off, only the summary is reported.
+    mock.contact_z = -500;
+    block.words.k = block.words.p = block.words.r = block.words.l = On;
+    block.values.ijk[Z_AXIS] = -20.0f;
+    block.values.p = 100.0f;
+    block.values.r = 1.0f;
+    block.values.l = 5;
+    CHECK(mcode(406, &block) == Status_OK);
+    CHECK(mock.probe_moves == 6);
+    CHECK(sys.position[Z_AXIS] == -400);
+    CHECK(!strcmp(mock.output, "[RPT:5|MEAN:0.0000,0.0000,-5.0000|SD:0.0000,0.0000,0.0000|MIN:0.0000,0.0000,-5.0000|"
+                               "MAX:0.0000,0.0000,-5.0000|RANGE:0.0000,0.0000,0.0000]" ASCII_EOL));
+    CHECK(!cycle_active);
+
+    // aborted without a summary when the probe does not trigger.
+    mock.contact_z = MOCK_NO_CONTACT;
+    mock.output_len = 0;
+    block.words.k = block.words.p = block.words.l = On;
+    block.values.r = 0.0f;
+    CHECK(mcode(406, &block) == Status_OK);
+    CHECK(mock.output_len == 0);
+    CHECK(mock_message_seen("repeatability test aborted"));
+
+    block.words.k = block.words.p = block.words.l = On;
+    block.values.l = 1;
+    CHECK(mcode(406, &block) == Status_GcodeValueOutOfRange);
+}
+
+static void scenario_seek_feed (void)
+{
+    parser_block_t block = {0};
+    tool_data_t tool = {0};
+
+    probe_protect_settings.overtravel_limit = 0.5f;
+    settings_apply();
+    mock.contact_z = -50;
+
+    // the M405 seek runs at the tuned feed, also when a lower feed is requested.
+    probe_feed.feed[ProbeSource_Touch] = 400.0f;
+    block.words.i = block.words.j = block.words.k = block.words.p = block.words.q = On;
+    block.values.ijk[X_AXIS] = block.values.ijk[Y_AXIS] = 2.0f;
+    block.values.ijk[Z_AXIS] = 1.0f;
+    block.values.p = block.values.q = 1.0f;
+    block.values.f = 50.0f;
+    CHECK(mcode(405, &block) == Status_OK);
+    CHECK(mock.probe_feed == 400.0f);
+
+    // G38 feeds are only capped.
+    probe_feed.feed[ProbeSource_Touch] = 400.0f;
+    CHECK(probe_z(-20.0f, 50.0f) == GCProbe_Found);
+    CHECK(mock.probe_feed == 50.0f);
+    CHECK(move_to(0.0f, 0.0f, 0.0f));
+    probe_feed.feed[ProbeSource_Touch] = 400.0f;
+    CHECK(probe_z(-20.0f, 800.0f) == GCProbe_Found);
+    CHECK(mock.probe_feed == 400.0f);
+    CHECK(move_to(0.0f, 0.0f, 0.0f));
+
+    // the tool change seek at the toolsetter runs at the tuned feed, the locate move is capped.
+    settings.tool_change.seek_rate = 200.0f;
+    mock.contact_port = probe_protect_settings.tool_port;
+    tool_select(&tool, 3);
+    CHECK(grbl.on_probe_toolsetter(&tool, NULL, true, true));
+    probe_feed.feed[ProbeSource_Toolsetter] = 300.0f;
+    CHECK(probe_z(-20.0f, 200.0f) == GCProbe_Found);
+    CHECK(mock.probe_feed == 300.0f);
+    CHECK(move_to(0.0f, 0.0f, 0.0f));
+    probe_feed.feed[ProbeSource_Toolsetter] = 300.0f;
+    CHECK(probe_z(-20.0f, 20.0f) == GCProbe_Found);
+    CHECK(mock.probe_feed == 20.0f);
+    CHECK(grbl.on_probe_toolsetter(&tool, NULL, true, false));
+}
+
+static void scenario_probe_accel (void)
+{
+    tool_data_t tool = {0};
+
+    probe_protect_settings.probe_accel = 300;
+    settings_apply();
+    mock.contact_z = -50;
+
+    // not changed for the toolsetter approach moves.
+    tool_select(&tool, 3);
+    CHECK(grbl.on_probe_toolsetter(&tool, NULL, true, true));
+    CHECK(settings.axis[Z_AXIS].acceleration == 100.0f * 3600.0f);
+    CHECK(grbl.on_probe_toolsetter(&tool, NULL, true, false));
+
+    // only the axes of the probe move, only while it is planned.
+    CHECK(probe_z(-20.0f, 100.0f) == GCProbe_Found);
+    CHECK(mock.probe_accel[Z_AXIS] == 300.0f * 3600.0f);
+    CHECK(mock.probe_accel[X_AXIS] == 100.0f * 3600.0f);
+    CHECK(settings.axis[Z_AXIS].acceleration == 100.0f * 3600.0f);
+
+    // restored when the probe fails to start.
+    CHECK(probe_z(-20.0f, 100.0f) == GCProbe_FailInit);
+    CHECK(settings.axis[Z_AXIS].acceleration == 100.0f * 3600.0f);
+
+    // not raised when the probe is not run.
+    CHECK(move_to(0.0f, 0.0f, 0.0f));
+    mock.state = STATE_CHECK_MODE;
+    CHECK(probe_z(-20.0f, 100.0f) == GCProbe_CheckMode);
+    mock.state = STATE_IDLE;
+    CHECK(!mock.probe_armed && settings.axis[Z_AXIS].acceleration == 100.0f * 3600.0f);
+    CHECK(probe_z(-20.0f, 100.0f) == GCProbe_Found);
+    CHECK(settings.axis[Z_AXIS].acceleration == 100.0f * 3600.0f);
+}
+
+static void scenario_m408_boss (void)
+{
+    parser_block_t block = {0};
+
+    block.user_mcode = 408;
+    block.words.p = block.words.i = block.words.k = On;
+    block.values.p = (float)ProbeCycle_Boss;
+    block.values.ijk[X_AXIS] = 20.0f;
+    block.values.ijk[Z_AXIS] = 5.0f; // depth below the top of the boss
+    block.values.f = 100.0f;
+    CHECK(grbl.user_mcode.validate(&block) == Status_OK);
+
+    block.words.p = block.words.i = block.words.k = On;
+    block.values.ijk[Z_AXIS] = 0.0f;
+    CHECK(grbl.user_mcode.validate(&block) == Status_GcodeValueOutOfRange);
+}
+
+static void scenario_m408_edge (void)
+{
+    parser_block_t block = {0};
+    float offset[N_AXIS];
+
+    // Z edge with 1mm back off, the result becomes the G55 Z origin.
+    mock.contact_z = -500;
+    block.words.p = block.words.k = block.words.q = block.words.r = On;
+    block.values.p = (float)ProbeCycle_Edge;
+    block.values.ijk[Z_AXIS] = -20.0f;
+    block.values.q = 2.0f;
+    block.values.r = 1.0f;
+    block.values.f = 100.0f;
+    CHECK(mcode(408, &block) == Status_OK);
+    CHECK(strstr(mock.output, "[EDGE:Z-5.000]") != NULL);
+    CHECK(sys.position[Z_AXIS] == -400);
+    CHECK(settings_read_coord_data(CoordinateSystem_G54 + 1, &offset) && offset[Z_AXIS] == -5.0f && offset[X_AXIS] == 0.0f);
+    CHECK(!cycle_active);
+}
+
+static void scenario_m409_scan (void)
+{
+    parser_block_t block = {0};
+
+    // the make is recorded as an edge, then a sample every 1mm while deflected.
+    mock.contact_z = -500;
+    block.words.k = block.words.p = On;
+    block.values.ijk[Z_AXIS] = -10.0f;
+    block.values.p = 1.0f;
+    block.values.f = 100.0f;
+    CHECK(mcode(409, &block) == Status_OK);
+    CHECK(!strcmp(mock.output, "[SCAN:0.000,0.000,-5.000,3;0.000,0.000,-6.000,1;0.000,0.000,-7.000,1;0.000,0.000,-8.000,1;"
+                               "0.000,0.000,-9.000,1;0.000,0.000,-10.000,1]" ASCII_EOL "[SCANEND:6,0]" ASCII_EOL));
+    CHECK(sys.position[Z_AXIS] == -1000);
+    CHECK(hal.stepper.pulse_start != on_scan_pulse_start);
+    CHECK(!cycle_active);
+
+    // without P or Q only the break is recorded on the way back.
+    mock.output_len = 0;
+    block.words.k = On;
+    block.values.ijk[Z_AXIS] = 10.0f;
+    block.values.p = 0.0f;
+    CHECK(mcode(409, &block) == Status_OK);
+    CHECK(!strcmp(mock.output, "[SCAN:0.000,0.000,-10.000,1;0.000,0.000,-4.990,2]" ASCII_EOL "[SCANEND:2,0]" ASCII_EOL));
+}
+
+static void scenario_tlr_restart (void)
+{
+    tool_data_t tool = {0};
+
+    probe_protect_settings.options.persist_tlr = On;
+    settings_apply();
+
+    sys.tlo_reference[Z_AXIS] = -500;
+    sys.tlo_reference_set.z = On;
+    gc_state.tool_length_offset[Z_AXIS] = -3.0f;
+    tool.tool_id = 7;
+    grbl.on_tool_changed(&tool);
+
+    // power cycle, the core clears the reference and the cache is lost.
+    memset(tool_cache, 0, sizeof(tool_cache));
+    memset(&tlr, 0, sizeof(tlr));
+    sys.tlo_reference[Z_AXIS] = 0;
+    sys.tlo_reference_set.z = Off;
+    mock_settings->load();
+    mock_run_tasks();
+
+    CHECK(sys.tlo_reference_set.z && sys.tlo_reference[Z_AXIS] == -500);
+    CHECK(tool_cache_slot(7)->tool_id == 7 && fabsf(tool_cache_slot(7)->contact - -8.0f) < 1e-4f);
+    CHECK(tool_cache_get(7) == NULL);
+    CHECK(tool_cache_get(8) == NULL);
+
+    // the tool may have been swapped while off: measured in full, the stored length is only compared.
+    settings.tool_change.seek_rate = 500.0f;
+    mock.contact_port = probe_protect_settings.tool_port;
+    mock.contact_z = -600;
+    CHECK(grbl.on_probe_toolsetter(&tool, NULL, true, true));
+    CHECK(probe_z(-20.0f, 100.0f) == GCProbe_Found);
+    CHECK(mock.move_feed == 0.0f);
+    CHECK(grbl.on_probe_toolsetter(&tool, NULL, true, false));
+    CHECK(mock_message_seen("differs from cached"));
+    CHECK(tool_cache_get(7) != NULL && tool_cache_get(7)->contact == -6.0f);
+}
+
+static void scenario_spindown_interlock (void)
+{
+    uint32_t off_ms;
+    tool_data_t tool = {0};
+
+    probe_protect_settings.options.spindown_interlock = On;
+    probe_protect_settings.spindown_time = 500;
+    settings_apply();
+
+    tool_select(&tool, 3);
+    mock.contact_port = probe_protect_settings.tool_port;
+    mock.contact_z = -1000;
+
+    spindle_set(true);
+    CHECK(grbl.on_probe_toolsetter(&tool, NULL, true, true));
+    CHECK(probe_z(-20.0f, 100.0f) == GCProbe_Abort);
+    CHECK(mock_message_seen("spindle running"));
+    CHECK(!probing && !latch.armed);
+    CHECK(sys.position[Z_AXIS] == 0);
+
+    spindle_set(false);
+    off_ms = mock.ms;
+    CHECK(probe_z(-20.0f, 100.0f) == GCProbe_Found);
+    CHECK(mock.ms - off_ms >= 500);
+    CHECK(grbl.on_probe_toolsetter(&tool, NULL, true, false));
+}
+
+// handler further down the on_probe_start chain refusing the probe.
+static bool probe_refuse (axes_signals_t axes, float *target, plan_line_data_t *pl_data)
+{
+    return false;
+}
+
+static void scenario_tool_zone (void)
+{
+    float g59_3[N_AXIS] = { 50.0f, 50.0f, -10.0f };
+
+    probe_protect_settings.options.tool_zone = On;
+    probe_protect_settings.zone_radius = 10.0f;
+    probe_protect_settings.zone_height = 20.0f;
+    settings_apply();
+    sys.homed.x = sys.homed.y = On;
+
+    // written as by G10 L2 P9 while another coordinate system is active, no WCO change.
+    settings_write_coord_data(CoordinateSystem_G59_3, &g59_3);
+
+    CHECK(!move_to(50.0f, 50.0f, -20.0f));
+    CHECK(sys.position[X_AXIS] == 0 && sys.position[Z_AXIS] == 0);
+
+    CHECK(move_to(30.0f, 50.0f, 0.0f));
+    CHECK(!move_to(50.0f, 50.0f, 0.0f));
+
+    mock_state_set(STATE_TOOL_CHANGE);
+    CHECK(move_to(50.0f, 50.0f, -20.0f));
+    mock_state_set(STATE_IDLE);
+
+    // leaving the box is allowed.
+    CHECK(move_to(50.0f, 50.0f, 0.0f));
+    CHECK(move_to(0.0f, 0.0f, 0.0f));
+
+    g59_3[X_AXIS] = 100.0f;
+    settings_write_coord_data(CoordinateSystem_G59_3, &g59_3);
+    CHECK(move_to(50.0f, 50.0f, -20.0f));
+    CHECK(!move_to(100.0f, 50.0f, -20.0f));
+
+    // probes that are not run do not leave the zone disabled.
+    mock.contact_z = 0;
+    CHECK(probe_z(-30.0f, 100.0f) == GCProbe_FailInit);
+    CHECK(!probing && !latch.armed);
+    CHECK(!move_to(100.0f, 50.0f, -20.0f));
+
+    mock.contact_z = MOCK_NO_CONTACT;
+    on_probe_start = probe_refuse;
+    CHECK(probe_z(-30.0f, 100.0f) == GCProbe_Abort);
+    CHECK(!probing && !latch.armed);
+    on_probe_start = NULL;
+    CHECK(!move_to(100.0f, 50.0f, -20.0f));
+}
+
+static void scenario_macros (void)
+{
+    strcpy(macro_settings.connect, "G53G0Z-5|M64P0");
+    strcpy(macro_settings.disconnect, "M65P0");
+    ext_pin_setup();
+
+    // restored from their own NVS block.
+    memset(&macro_settings, 0, sizeof(macro_settings));
+    mock_settings->load();
+    mock_run_tasks();
+    CHECK(!strcmp(macro_settings.connect, "G53G0Z-5|M64P0"));
+    CHECK(connect_macro.lines == 2 && disconnect_macro.lines == 1);
+
+    ext_pin_set(true);
+    CHECK(probe_connected.ext_pin);
+    mock_realtime(1);
+    mock_realtime(1);
+    CHECK(mock.gcode_lines == 2 && !strcmp(mock.gcode[0], "G53G0Z-5") && !strcmp(mock.gcode[1], "M64P0"));
+
+    ext_pin_set(false);
+    mock_realtime(1);
+    CHECK(mock.gcode_lines == 3 && !strcmp(mock.gcode[2], "M65P0"));
+
+    // not run for connect changes made by the program.
+    CHECK(mcode(401, NULL) == Status_OK);
+    mock_realtime(1);
+    CHECK(mcode(402, NULL) == Status_OK);
+    mock_realtime(1);
+    CHECK(mock.gcode_lines == 3);
+
+    // dropped and reported when a job may be running.
+    mock.rx_count = 20;
+    ext_pin_set(true);
+    mock_realtime(1);
+    CHECK(mock.gcode_lines == 3);
+    CHECK(mock_message_seen("macro not run"));
+    mock.rx_count = 0;
+
+    gc_state.file_run = true;
+    ext_pin_set(false);
+    mock_realtime(1);
+    CHECK(mock.gcode_lines == 3);
+    gc_state.file_run = false;
+
+    mock.state = STATE_CYCLE;
+    ext_pin_set(true);
+    mock.state = STATE_IDLE;
+    mock_realtime(1);
+    CHECK(mock.gcode_lines == 3);
+    ext_pin_set(false);
+    mock_realtime(1);
+    CHECK(mock.gcode_lines == 4);
+
+    // disabled when there was no room for the NVS block.
+    macro_address = 0;
+    mock_settings->load();
+    mock_run_tasks();
+    CHECK(connect_macro.lines == 0 && disconnect_macro.lines == 0);
+    ext_pin_set(true);
+    mock_realtime(1);
+    CHECK(mock.gcode_lines == 4);
+}
+
+// Toggles the external connected pin without waiting for the debounce window.
+static void ext_pin_edge (bool level)
+{
+    mock.port[EXT_PIN_PORT] = level;
+    mock.irq[EXT_PIN_PORT](EXT_PIN_PORT, level);
+}
+
+static void scenario_connect_debounce (void)
+{
+    uint_fast8_t idx;
+    uint32_t edges;
+
+    ext_pin_setup();
+    edges = debounce[Debounce_Connect].edges;
+
+    // a pulse shorter than the window is filtered, its edges are still counted.
+    ext_pin_edge(true);
+    mock_realtime(probe_protect_settings.connect_debounce / 2);
+    ext_pin_edge(false);
+    mock_realtime(probe_protect_settings.connect_debounce);
+    CHECK(!probe_connected.ext_pin);
+    CHECK(!protection_enabled);
+    CHECK(debounce[Debounce_Connect].edges == edges + 2);
+
+    // chatter settling on the other level is confirmed once the window has expired.
+    for(idx = 0; idx < 5; idx++)
+        ext_pin_edge(!(idx & 1));
+    mock_realtime(probe_protect_settings.connect_debounce - 1);
+    CHECK(!probe_connected.ext_pin);
+    mock_realtime(1);
+    CHECK(probe_connected.ext_pin);
+    CHECK(protection_enabled);
+    CHECK(debounce[Debounce_Connect].edges == edges + 7);
+    CHECK(!debounce[Debounce_Connect].pending);
+
+    ext_pin_set(false);
+    CHECK(!probe_connected.ext_pin);
+    CHECK(!protection_enabled);
+}
+
+static void scenario_connect_storm (void)
+{
+    uint_fast8_t idx;
+    uint32_t messages;
+    char line[48];
+
+    ext_pin_setup();
+
+    // a window with PROBE_STORM_EDGES edges is reported once, the level is still confirmed after the window.
+    for(idx = 0; idx < PROBE_STORM_EDGES; idx++)
+        ext_pin_edge(!(idx & 1));
+    mock_realtime(probe_protect_settings.connect_debounce);
+    CHECK(debounce[Debounce_Connect].storm);
+    CHECK(debounce[Debounce_Connect].storms == 1);
+    CHECK(debounce[Debounce_Connect].max_window_edges == PROBE_STORM_EDGES);
+    CHECK(mock_message_seen("interrupt storm on connected input"));
+    CHECK(!probe_connected.ext_pin);
+
+    // a storm lasting several windows is counted and reported once.
+    messages = mock.messages;
+    for(idx = 0; idx < PROBE_STORM_EDGES * 2; idx++)
+        ext_pin_edge(!(idx & 1));
+    mock_realtime(probe_protect_settings.connect_debounce);
+    CHECK(debounce[Debounce_Connect].storms == 1);
+    CHECK(debounce[Debounce_Connect].max_window_edges == PROBE_STORM_EDGES * 2);
+    CHECK(mock.messages == messages);
+
+    // it ends with the first quiet window.
+    ext_pin_set(true);
+    CHECK(!debounce[Debounce_Connect].storm);
+    CHECK(probe_connected.ext_pin);
+
+    mock.output_len = 0;
+    CHECK(report_edges(STATE_IDLE, NULL) == Status_OK);
+    sprintf(line, "[PROBEEDGES:connected,%u,%u,1,0]", PROBE_STORM_EDGES * 3 + 1, PROBE_STORM_EDGES * 2);
+    CHECK(strstr(mock.output, line) != NULL);
+    CHECK(strstr(mock.output, "[PROBEEDGES:probe,0,0,0,0]") != NULL);
+}
+
+static void scenario_heartbeat (void)
+{
+    uint_fast8_t idx;
+    stepper_pulse_start_ptr driver_pulse_start = hal.stepper.pulse_start;
+
+    ext_pin_setup();
+    probe_protect_settings.options.heartbeat = On;
+    settings_apply();
+    CHECK(mock.irq[EXT_PIN_PORT] == on_heartbeat);
+    CHECK(!probe_connected.ext_pin);
+
+    // pulses arriving within the timeout keep the probe connected and protected.
+    for(idx = 0; idx < 5; idx++) {
+        mock.irq[EXT_PIN_PORT](EXT_PIN_PORT, idx & 1);
+        mock_realtime(probe_protect_settings.heartbeat_timeout / 2);
+        CHECK(probe_connected.ext_pin);
+        CHECK(protection_enabled);
+    }
+
+    // a missed heartbeat disconnects the probe and disarms protection.
+    mock_realtime(probe_protect_settings.heartbeat_timeout);
+    CHECK(!probe_connected.ext_pin);
+    CHECK(!protection_enabled);
+    CHECK(hal.stepper.pulse_start == driver_pulse_start);
+    CHECK(mock_message_seen("probe heartbeat lost"));
+}
+
+// Returns the number of times s occurs in the stream output.
+static uint_fast16_t output_count (const char *s)
+{
+    uint_fast16_t count = 0;
+    const char *p = mock.output;
+
+    while((p = strstr(p, s))) {
+        count++;
+        p++;
+    }
+
+    return count;
+}
+
+// Returns the sequence number of the first event of the given type from seq on, trace.head if none.
+static uint32_t trace_find (uint32_t seq, trace_event_t type, trace_entry_t *event)
+{
+    for(; seq != trace.head; seq++) {
+        if(trace_get(seq, event) && event->event == type)
+            break;
+    }
+
+    return seq;
+}
+
+static void scenario_trace (void)
+{
+    uint_fast16_t idx;
+    uint32_t on, stop, head;
+    trace_entry_t event, stop_event;
+    char line[40];
+
+    CHECK(mcode(401, NULL) == Status_OK);
+    CHECK((on = trace_find(0, Event_ProtectionOn, &event)) != trace.head);
+
+    // the stop is recorded after the edge and its confirmation and reported from the realtime loop.
+    mock.probe_level = true;
+    mock_step_pulse();
+    mock_realtime(PROBE_DEBOUNCE);
+    CHECK(mock.cmd_stop == 1);
+    CHECK((stop = trace_find(on, Event_CmdStop, &stop_event)) != trace.head);
+    CHECK(stop_event.data == Stop_ProbeProtect);
+    CHECK(trace_find(on, Event_Edge, &event) < stop && event.data == ((Debounce_Probe << 1) | 1));
+    CHECK(trace_find(on, Event_DebounceConfirm, &event) < stop && event.us <= stop_event.us);
+    CHECK(mock_message_seen("PROBE PROTECTED!"));
+    CHECK(trace.tail == trace.head);
+
+    // events not drained in time are overwritten, the oldest first.
+    head = trace.head;
+    for(idx = 0; idx < PROBE_TRACE_SIZE * 2; idx++)
+        trace_add(Event_SourceSelect, (uint8_t)idx);
+    CHECK(!trace_get(head, &event));
+    CHECK(trace_get(trace.head - 1, &event) && event.event == Event_SourceSelect && event.data == PROBE_TRACE_SIZE * 2 - 1);
+    trace_drain();
+    CHECK(trace.tail == trace.head);
+
+    mock.output_len = 0;
+    CHECK(report_trace(STATE_IDLE, NULL) == Status_OK);
+    CHECK(output_count("[PROBETRACE:") == PROBE_TRACE_SIZE);
+    sprintf(line, "[PROBETRACE:%u,", (unsigned)(trace.head - PROBE_TRACE_SIZE));
+    CHECK(!strncmp(mock.output, line, strlen(line)));
+    sprintf(line, ",source,%u]", PROBE_TRACE_SIZE * 2 - 1);
+    CHECK(output_count(line) == 1);
+}
+
+#define RECORD_SIZE (3 + 4 + N_AXIS * 4 + 1)
+
+static void scenario_binary_records (void)
+{
+    tool_data_t tool = {0};
+    const char *record = mock.output;
+
+    probe_protect_settings.options.binary_report = On;
+    settings_apply();
+
+    // touch probe hit at Z-5.
+    mock.contact_z = -500;
+    CHECK(probe_z(-20.0f, 100.0f) == GCProbe_Found);
+    CHECK(mock.output_len == RECORD_SIZE);
+    CHECK((uint8_t)record[0] == 0xA5 && record[1] == 'P' && record[2] == RECORD_SIZE - 4);
+    CHECK(record[3] == 0 && record[4] == 0);
+    CHECK(record[5] == PROBE_RECORD_SUCCEEDED && record[6] == N_AXIS);
+    CHECK(record_int32(&record[7]) == 0 && record_int32(&record[11]) == 0 && record_int32(&record[15]) == -5000);
+    CHECK((uint8_t)record[19] == record_crc(&record[3], RECORD_SIZE - 4));
+
+    // a miss is recorded as not succeeded, with the next sequence number.
+    move_to(0.0f, 0.0f, 0.0f);
+    mock.contact_z = MOCK_NO_CONTACT;
+    mock.output_len = 0;
+    CHECK(probe_z(-10.0f, 100.0f) == GCProbe_FailEnd);
+    CHECK(mock.output_len == RECORD_SIZE);
+    CHECK(record[3] == 1 && record[4] == 0 && record[5] == 0);
+    CHECK((uint8_t)record[19] == record_crc(&record[3], RECORD_SIZE - 4));
+
+    // toolsetter hit.
+    move_to(0.0f, 0.0f, 0.0f);
+    tool_select(&tool, 5);
+    mock.contact_port = probe_protect_settings.tool_port;
+    mock.contact_z = -1000;
+    mock.output_len = 0;
+    CHECK(grbl.on_probe_toolsetter(&tool, NULL, true, true));
+    CHECK(probe_z(-20.0f, 100.0f) == GCProbe_Found);
+    CHECK(grbl.on_probe_toolsetter(&tool, NULL, true, false));
+    CHECK(mock.output_len == RECORD_SIZE);
+    CHECK(record[3] == 2);
+    CHECK(record[5] == (PROBE_RECORD_SUCCEEDED | PROBE_RECORD_TOOLSETTER | (ProbeSource_Toolsetter << PROBE_RECORD_SOURCE_SHIFT)));
+    CHECK(record_int32(&record[15]) == -10000);
+
+    // nothing is written with the option off.
+    probe_protect_settings.options.binary_report = Off;
+    settings_apply();
+    move_to(0.0f, 0.0f, 0.0f);
+    mock.contact_port = MOCK_PORTS;
+    mock.contact_z = -500;
+    mock.output_len = 0;
+    CHECK(probe_z(-20.0f, 100.0f) == GCProbe_Found);
+    CHECK(mock.output_len == 0);
+}
+
+static void scenario_setting_ids (void)
+{
+    uint_fast8_t idx, idx2, n_settings = mock_settings->n_settings;
+
+    // Only the original aux input settings use the user defined range, the rest is a block of consecutive ids.
+    CHECK(n_settings == sizeof(user_settings) / sizeof(setting_detail_t));
+    for(idx = 0; idx < n_settings; idx++) {
+        setting_id_t id = mock_settings->settings[idx].id;
+        if(idx < PROBE_PLUGIN_BASE_SETTINGS)
+            CHECK(id >= Setting_UserDefined_7 && id <= Setting_UserDefined_9);
+        else
+            CHECK(id == PROBE_PLUGIN_SETTING(idx - PROBE_PLUGIN_BASE_SETTINGS));
+        for(idx2 = 0; idx2 < idx; idx2++)
+            CHECK(mock_settings->settings[idx2].id != id);
+    }
+
+    // An id of the block registered elsewhere leaves only the aux input settings.
+    mock_init();
+    mock.taken_setting = PROBE_PLUGIN_HEARTBEAT_SETTING;
+    probe_protect_init();
+    mock_run_tasks();
+    CHECK(mock_settings->n_settings == PROBE_PLUGIN_BASE_SETTINGS);
+    CHECK(mock_message_seen("in use, extended settings disabled"));
+}
+
+static bool run (const char *name, void (*scenario)(void))
+{
+    int status;
+    bool ok;
+    pid_t pid;
+
+    fflush(stdout);
+
+    if((pid = fork()) == 0) {
+        plugin_init();
+        scenario();
+        fflush(stdout);
+        _exit(failures ? 1 : 0);
+    }
+
+    ok = pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    printf("%s %s\n", ok ? "PASS" : "FAIL", name);
+
+    return ok;
+}
+
+static double elapsed_ns (struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    return (double)(t1.tv_sec - t0->tv_sec) * 1e9 + (double)(t1.tv_nsec - t0->tv_nsec);
+}
+
+static void bench_report (const char *name, double ns, uint32_t calls)
+{
+    printf("%-44s %8.1f ns/call\n", name, ns / calls);
+}
+
+static void bench (void)
+{
+    uint32_t idx;
+    struct timespec t0;
+    float target[N_AXIS] = {0};
+    axes_signals_t axes = { .z = On };
+    plan_line_data_t plan_data;
+    spindle_state_t spindle = {0};
+
+    plugin_init();
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(idx = 0; idx < BENCH_CALLS; idx++)
+        mock_step_pulse();
+    bench_report("step pulse, protection off", elapsed_ns(&t0), BENCH_CALLS);
+
+    mcode(401, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(idx = 0; idx < BENCH_CALLS; idx++)
+        mock_step_pulse();
+    bench_report("step pulse, protection on (on_pulse_start)", elapsed_ns(&t0), BENCH_CALLS);
+
+    mcode(402, NULL);
+    plan_data_init(&plan_data);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(idx = 0; idx < BENCH_CALLS; idx++) {
+        plan_data.feed_rate = 100.0f;
+        grbl.on_probe_start(axes, target, &plan_data);
+        sys.flags.probe_succeeded = On;
+        grbl.on_probe_completed();
+    }
+    bench_report("probe_start + probe_completed", elapsed_ns(&t0), BENCH_CALLS);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for(idx = 0; idx < BENCH_CALLS; idx++)
+        mock_spindle.set_state(&mock_spindle, spindle, 0.0f);
+    bench_report("onSpindleSetState", elapsed_ns(&t0), BENCH_CALLS);
+}
+
+int main (int argc, char **argv)
+{
+    bool ok = true;
+
+    if(argc > 1 && !strcmp(argv[1], "bench")) {
+        bench();
+        return 0;
+    }
+
+    ok &= run("M401/M402 connect and motion protection", scenario_m401_m402);
+    ok &= run("M401/M402 interrupt driven protection", scenario_protect_irq);
+    ok &= run("T99 selection", scenario_t99);
+    ok &= run("G59.3 tool probing", scenario_tool_probe);
+    ok &= run("M407 probe source selection", scenario_m407_select);
+    ok &= run("cached tool approach", scenario_cache_approach);
+    ok &= run("spindle on while connected", scenario_spindle_connected);
+    ok &= run("M403 two stage probe", scenario_m403_two_stage);
+    ok &= run("M405 surface map", scenario_m405_map);
+    ok &= run("M406 repeatability test", scenario_m406_repeatability);
+    ok &= run("adaptive feed seek moves", scenario_seek_feed);
+    ok &= run("probing acceleration", scenario_probe_accel);
+    ok &= run("M408 boss depth", scenario_m408_boss);
+    ok &= run("M408 edge", scenario_m408_edge);
+    ok &= run("M409 scan", scenario_m409_scan);
+    ok &= run("TLR offsets seed the tool cache after restart", scenario_tlr_restart);
+    ok &= run("spindle spin-down interlock", scenario_spindown_interlock);
+    ok &= run("toolsetter zone", scenario_tool_zone);
+    ok &= run("connect macros", scenario_macros);
+    ok &= run("connect input debounce", scenario_connect_debounce);
+    ok &= run("connect input interrupt storm", scenario_connect_storm);
+    ok &= run("probe heartbeat", scenario_heartbeat);
+    ok &= run("event trace", scenario_trace);
+    ok &= run("binary probe records", scenario_binary_records);
+    ok &= run("setting ids", scenario_setting_ids);
+
+    return ok ? 0 : 1;
+}